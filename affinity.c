@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "affinity.h"
+
+int affinity_parse(const char *list, int *cpus)
+{
+  int num = 0;
+  const char *p = list;
+
+  while (*p)
+  {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+
+    if (end == p || first < 0) { return -1; }
+
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) { return -1; }
+    }
+
+    for (; first <= last; ++first)
+    {
+      if (num == AFFINITY_MAX_CPUS) { return -1; }
+      cpus[num++] = first;
+    }
+
+    if (*end == ',') { ++end; }
+    else if (*end) { return -1; }
+
+    p = end;
+  }
+
+  return num;
+}
+
+int affinity_option(struct affinity *aff, int opt, const char *arg)
+{
+  int num = 0;
+
+  switch (opt)
+  {
+    case 'c':
+      num = aff->num_control = affinity_parse(arg, aff->control);
+      break;
+    case 'W':
+      num = aff->num_workers = affinity_parse(arg, aff->workers);
+      break;
+    case 'I':
+      num = aff->num_io = affinity_parse(arg, aff->io);
+      break;
+    case 'p':
+      aff->rt_priority = atoi(arg);
+      break;
+    default:
+      return 0;
+  }
+
+  if (num < 0)
+  {
+    fprintf(stderr, "Bad cpu list '%s'\n", arg);
+    exit(EXIT_FAILURE);
+  }
+
+  return 1;
+}
+
+void affinity_help(void)
+{
+  printf("  [-c]                           Cpus of the control/DMA thread, e.g. 1 or 0,2-3\n");
+  printf("  [-W]                           Cpus of the worker threads\n");
+  printf("  [-I]                           Cpus of the io threads\n");
+  printf("  [-p]                           SCHED_FIFO priority of the control thread\n");
+}
+
+int affinity_pin(const int *cpus, int num_cpus)
+{
+  cpu_set_t set;
+  int i, ret;
+
+  if (!num_cpus) { return 0; }
+
+  CPU_ZERO(&set);
+  for (i = 0; i < num_cpus; ++i)
+  {
+    CPU_SET(cpus[i], &set);
+  }
+
+  ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret)
+  {
+    fprintf(stderr, "pthread_setaffinity_np failed: %s\n", strerror(ret));
+    return -1;
+  }
+
+  return 0;
+}
+
+int affinity_pin_nth(const int *cpus, int num_cpus, int n)
+{
+  if (!num_cpus) { return 0; }
+
+  return affinity_pin(&cpus[n % num_cpus], 1);
+}
+
+void affinity_apply_priority(const struct affinity *aff)
+{
+  struct sched_param param;
+  int ret;
+
+  if (!aff->rt_priority) { return; }
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = aff->rt_priority;
+
+  ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (ret)
+  {
+    // usually missing CAP_SYS_NICE or an rtprio limit, not fatal
+    fprintf(stderr, "SCHED_FIFO priority %d failed: %s\n",
+        aff->rt_priority, strerror(ret));
+  }
+}
+
+void affinity_apply_control(const struct affinity *aff)
+{
+  affinity_pin(aff->control, aff->num_control);
+  affinity_apply_priority(aff);
+}
+
+static void log_list(FILE *fp, const char *name, const int *cpus, int num)
+{
+  int i;
+
+  fprintf(fp, "  %s:", name);
+  if (!num) { fprintf(fp, " any"); }
+  for (i = 0; i < num; ++i)
+  {
+    fprintf(fp, i ? ",%d" : " %d", cpus[i]);
+  }
+  fprintf(fp, "\n");
+}
+
+void affinity_log_config(FILE *fp, const struct affinity *aff)
+{
+  fprintf(fp, "Affinity (%ld cpus online):\n", sysconf(_SC_NPROCESSORS_ONLN));
+  log_list(fp, "control", aff->control, aff->num_control);
+  log_list(fp, "workers", aff->workers, aff->num_workers);
+  log_list(fp, "io", aff->io, aff->num_io);
+}
+
+void affinity_log(FILE *fp, const char *name)
+{
+  cpu_set_t set;
+  struct sched_param param;
+  int policy, cpu;
+  int first = 1;
+
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set)) { return; }
+  pthread_getschedparam(pthread_self(), &policy, &param);
+
+  fprintf(fp, "%s thread: cpus ", name);
+  for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (CPU_ISSET(cpu, &set))
+    {
+      fprintf(fp, first ? "%d" : ",%d", cpu);
+      first = 0;
+    }
+  }
+
+  fprintf(fp, ", running on %d, %s", sched_getcpu(), policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER");
+  if (policy == SCHED_FIFO) { fprintf(fp, " prio %d", param.sched_priority); }
+  fprintf(fp, "\n");
+}
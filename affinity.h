@@ -0,0 +1,55 @@
+#ifndef C63_AFFINITY_H_
+#define C63_AFFINITY_H_
+#include <stdio.h>
+
+#define AFFINITY_MAX_CPUS 64
+
+/* Where the threads of a binary run. The control thread is the one
+   spinning on the control segment and driving the DMA transfers, workers
+   do encode/decode work and io threads do file reads and writes. An empty
+   list leaves placement to the scheduler. */
+struct affinity
+{
+  int control[AFFINITY_MAX_CPUS];
+  int num_control;
+  int workers[AFFINITY_MAX_CPUS];
+  int num_workers;
+  int io[AFFINITY_MAX_CPUS];
+  int num_io;
+  int rt_priority;      //SCHED_FIFO priority of the control thread, 0 = off
+};
+
+/* Handle one of the shared affinity options, -c (control cpus), -W
+   (worker cpus), -I (io cpus) and -p (SCHED_FIFO priority). Returns 0 if
+   opt is not one of them and exits on a bad argument. */
+int affinity_option(struct affinity *aff, int opt, const char *arg);
+
+/* Print the affinity options for print_help */
+void affinity_help(void);
+
+/* Parse a cpu list like "0,2-3" into cpus, returns the number of cpus or
+   -1 on a malformed list */
+int affinity_parse(const char *list, int *cpus);
+
+/* Pin the calling thread to the given cpus */
+int affinity_pin(const int *cpus, int num_cpus);
+
+/* Pin the calling thread to cpu n of the list, wrapping around, for the
+   n-th thread of a pool */
+int affinity_pin_nth(const int *cpus, int num_cpus, int n);
+
+/* Run the calling thread at SCHED_FIFO rt_priority, if one is set. A
+   spinning thread at that priority never yields, so it must have its cpu
+   to itself. */
+void affinity_apply_priority(const struct affinity *aff);
+
+/* Pin the calling thread as the control thread and apply rt_priority */
+void affinity_apply_control(const struct affinity *aff);
+
+/* Log the configured cpu lists */
+void affinity_log_config(FILE *fp, const struct affinity *aff);
+
+/* Log the cpus the calling thread is allowed on and its policy */
+void affinity_log(FILE *fp, const char *name);
+
+#endif  /* C63_AFFINITY_H_ */
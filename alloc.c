@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "alloc.h"
+#include "common.h"
+#include "perf.h"
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+/* Each c63server session maps its segments' backing memory and its frame
+   planes, with room to spare */
+#define MAX_MAPPINGS (MAX_SESSIONS*8)
+
+static enum alloc_mode mode = ALLOC_DEFAULT;
+
+/* MAP_HUGETLB regions have to be unmapped with their size. Session
+   threads allocate and free concurrently, mappings_lock guards the table. */
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+  void *ptr;
+  size_t size;
+} mappings[MAX_MAPPINGS];
+
+static int tlb_fd = -1;
+static long last_minflt, last_majflt;
+static uint64_t last_tlb;
+
+enum alloc_mode alloc_parse_mode(const char *name)
+{
+  if (!strcmp(name, "huge")) { return ALLOC_HUGETLB; }
+  if (!strcmp(name, "thp")) { return ALLOC_THP; }
+  if (!strcmp(name, "none")) { return ALLOC_DEFAULT; }
+
+  fprintf(stderr, "Unknown frame memory %s, use none, thp or huge\n", name);
+  exit(EXIT_FAILURE);
+}
+
+void alloc_init(enum alloc_mode m)
+{
+  mode = m;
+
+  // dTLB load misses of this process, reported next to the page faults
+  tlb_fd = perf_counter_open(PERF_DTLB_MISSES);
+
+  alloc_report(NULL, NULL);
+}
+
+enum alloc_mode alloc_mode(void)
+{
+  return mode;
+}
+
+static void *alloc_thp(size_t size)
+{
+  void *ptr;
+
+  size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+  if (posix_memalign(&ptr, HUGE_PAGE_SIZE, size)) { return NULL; }
+
+  madvise(ptr, size, MADV_HUGEPAGE);
+
+  return ptr;
+}
+
+static void *alloc_hugetlb(size_t size)
+{
+  void *ptr;
+  int i;
+
+  size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+  pthread_mutex_lock(&mappings_lock);
+
+  for (i = 0; i < MAX_MAPPINGS && mappings[i].ptr; ++i);
+  if (i == MAX_MAPPINGS)
+  {
+    pthread_mutex_unlock(&mappings_lock);
+    return NULL;
+  }
+
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED)
+  {
+    pthread_mutex_unlock(&mappings_lock);
+    return NULL;
+  }
+
+  mappings[i].ptr = ptr;
+  mappings[i].size = size;
+
+  pthread_mutex_unlock(&mappings_lock);
+
+  return ptr;
+}
+
+void *c63_alloc(size_t size)
+{
+  void *ptr = NULL;
+
+  if (mode == ALLOC_DEFAULT) { return calloc(1, size); }
+
+  if (mode == ALLOC_HUGETLB)
+  {
+    ptr = alloc_hugetlb(size);
+
+    if (!ptr)
+    {
+      fprintf(stderr, "No hugetlb pages for %zu bytes, using THP\n", size);
+    }
+  }
+
+  if (!ptr) { ptr = alloc_thp(size); }
+
+  if (!ptr)
+  {
+    perror("c63_alloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Touch every page now, rather than on the first frame */
+  memset(ptr, 0, size);
+
+  if (mlock(ptr, size))
+  {
+    perror("mlock");
+  }
+
+  return ptr;
+}
+
+void c63_free(void *ptr)
+{
+  int i;
+
+  if (!ptr) { return; }
+
+  pthread_mutex_lock(&mappings_lock);
+  for (i = 0; i < MAX_MAPPINGS; ++i)
+  {
+    if (mappings[i].ptr == ptr)
+    {
+      munmap(ptr, mappings[i].size);
+      mappings[i].ptr = NULL;
+      pthread_mutex_unlock(&mappings_lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&mappings_lock);
+
+  free(ptr);
+}
+
+void alloc_report(FILE *fp, const char *phase)
+{
+  struct rusage usage;
+  uint64_t tlb;
+
+  getrusage(RUSAGE_SELF, &usage);
+  tlb = perf_counter_read(tlb_fd);
+
+  if (fp)
+  {
+    fprintf(fp, "%s: %ld minor / %ld major page faults, ", phase,
+        usage.ru_minflt - last_minflt, usage.ru_majflt - last_majflt);
+
+    if (tlb_fd >= 0)
+    {
+      fprintf(fp, "%llu dTLB misses\n", (unsigned long long)(tlb - last_tlb));
+    }
+    else
+    {
+      fprintf(fp, "dTLB misses n/a\n");
+    }
+  }
+
+  last_minflt = usage.ru_minflt;
+  last_majflt = usage.ru_majflt;
+  last_tlb = tlb;
+}
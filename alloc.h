@@ -0,0 +1,32 @@
+#ifndef C63_ALLOC_H_
+#define C63_ALLOC_H_
+#include <stddef.h>
+#include <stdio.h>
+
+/* Allocator for frame planes and segment memory. With huge pages a 1080p
+   frame fits in a handful of TLB entries instead of thousands. Anything
+   other than ALLOC_DEFAULT also pre-faults and mlock()s the memory, so no
+   page faults happen once encoding has started. */
+enum alloc_mode
+{
+  ALLOC_DEFAULT,  //plain calloc
+  ALLOC_THP,      //2 MiB aligned, madvise(MADV_HUGEPAGE)
+  ALLOC_HUGETLB   //mmap(MAP_HUGETLB), falls back to ALLOC_THP
+};
+
+/* Parse "none", "thp" or "huge" */
+enum alloc_mode alloc_parse_mode(const char *name);
+
+void alloc_init(enum alloc_mode mode);
+
+enum alloc_mode alloc_mode(void);
+
+/* Zeroed memory, like calloc(1, size) */
+void *c63_alloc(size_t size);
+
+void c63_free(void *ptr);
+
+/* Print page faults and dTLB misses since the previous call */
+void alloc_report(FILE *fp, const char *phase);
+
+#endif  /* C63_ALLOC_H_ */
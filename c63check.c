@@ -0,0 +1,478 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dsp.h"
+#include "pool.h"
+#include "tables.h"
+#include "transform.h"
+
+/* Compares the selectable block transforms against the float reference in
+   dsp.c on real frames. Every 8x8 block is intra coded through both paths
+   and the reconstructions are compared with the source and each other.
+   The frames are also encoded as a stream with made-up motion vectors and
+   decoded by macroblock rows over a pool, like c63dec does, which has to
+   match the serial transform_dequantize_idct decode exactly. */
+
+static uint32_t width;
+static uint32_t height;
+static int qp = 25;
+static int limit_numframes = 0;
+static int num_threads = 4;
+
+/* getopt */
+extern int optind;
+extern char *optarg;
+
+struct path_stats
+{
+  double sse;           //against the source
+  double seconds;
+};
+
+static void print_help()
+{
+  printf("Usage: ./c63check [options] input_file\n");
+  printf("Commandline options:\n");
+  printf("  -h                             Height of images\n");
+  printf("  -w                             Width of images\n");
+  printf("  [-q]                           Quantization factor (default 25)\n");
+  printf("  [-f]                           Limit number of frames to check\n");
+  printf("  [-j]                           Threads of the row decode (default 4)\n");
+  printf("\n");
+
+  exit(EXIT_FAILURE);
+}
+
+static double psnr(double sse, double samples)
+{
+  if (sse == 0.0) { return INFINITY; }
+
+  return 10.0 * log10(255.0 * 255.0 * samples / sse);
+}
+
+static double seconds_since(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1e9;
+}
+
+/* The reciprocal quantizer of the int path against plain division, for
+   every table entry and every coefficient it is specified for */
+static long check_quantizer(void)
+{
+  long mismatch = 0;
+  int32_t coeff;
+  int q;
+
+  for (q = 0; q < 256; ++q)
+  {
+    int32_t d = 8 * (q ? q : 1);
+
+    for (coeff = -QUANT_COEFF_MAX; coeff <= QUANT_COEFF_MAX; ++coeff)
+    {
+      int32_t expected = coeff >= 0 ? (coeff + d/2) / d : -((-coeff + d/2) / d);
+
+      if (quantize_int(coeff, q) != expected)
+      {
+        if (!mismatch)
+        {
+          fprintf(stderr, "Quantizer mismatch: %d / %d gives %d, expected %d\n",
+              coeff, d, quantize_int(coeff, q), expected);
+        }
+        ++mismatch;
+      }
+    }
+  }
+
+  return mismatch;
+}
+
+/* A frame of the decode check, with the buffers the row kernels use */
+static struct frame *alloc_frame(struct c63_common *cm)
+{
+  struct frame *f = calloc(1, sizeof(struct frame));
+  int c;
+
+  f->recons = calloc(1, sizeof(yuv_t));
+  f->predicted = calloc(1, sizeof(yuv_t));
+  f->residuals = calloc(1, sizeof(dct_t));
+
+  f->recons->Y = calloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT], 1);
+  f->recons->U = calloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT], 1);
+  f->recons->V = calloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT], 1);
+  f->predicted->Y = calloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT], 1);
+  f->predicted->U = calloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT], 1);
+  f->predicted->V = calloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT], 1);
+  f->residuals->Ydct = calloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT], sizeof(int16_t));
+  f->residuals->Udct = calloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT], sizeof(int16_t));
+  f->residuals->Vdct = calloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT], sizeof(int16_t));
+
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    f->mbs[c] = calloc((cm->padw[c]/8)*(cm->padh[c]/8), sizeof(struct macroblock));
+  }
+
+  return f;
+}
+
+static void free_frame(struct frame *f)
+{
+  int c;
+
+  free(f->recons->Y); free(f->recons->U); free(f->recons->V);
+  free(f->predicted->Y); free(f->predicted->U); free(f->predicted->V);
+  free(f->residuals->Ydct); free(f->residuals->Udct); free(f->residuals->Vdct);
+  free(f->recons);
+  free(f->predicted);
+  free(f->residuals);
+  for (c = 0; c < COLOR_COMPONENTS; ++c) { free(f->mbs[c]); }
+  free(f);
+}
+
+/* Motion vectors for the decode check. They only have to keep each block
+   inside the plane and vary from block to block and frame to frame; some
+   blocks get no vector and are predicted from zero. */
+static void make_motion(struct macroblock *mbs, int cols, int rows, int frame)
+{
+  int bx, by;
+
+  for (by = 0; by < rows; ++by)
+  {
+    for (bx = 0; bx < cols; ++bx)
+    {
+      struct macroblock *mb = &mbs[by*cols + bx];
+      int mx = (bx*7 + by*3 + frame) % 9 - 4;
+      int my = (bx*5 + by*11 + frame*3) % 9 - 4;
+
+      if (bx*8 + mx < 0 || bx*8 + mx + 8 > cols*8) { mx = 0; }
+      if (by*8 + my < 0 || by*8 + my + 8 > rows*8) { my = 0; }
+
+      mb->use_mv = (bx + by + frame) % 4 != 0;
+      mb->mv_x = mx;
+      mb->mv_y = my;
+    }
+  }
+}
+
+/* Serial decode of one plane: motion compensation as the decoder does it
+   into pred, then transform_dequantize_idct */
+static void decode_plane(int16_t *residuals, const uint8_t *ref,
+    const struct macroblock *mbs, uint32_t w, uint32_t h, uint8_t *pred,
+    uint8_t *out, uint8_t *quanttbl)
+{
+  uint32_t x, y;
+  int i;
+
+  for (y = 0; y < h; y += 8)
+  {
+    for (x = 0; x < w; x += 8)
+    {
+      const struct macroblock *mb = &mbs[(y/8)*(w/8) + x/8];
+
+      for (i = 0; i < 8; ++i)
+      {
+        if (ref && mb->use_mv)
+        {
+          memcpy(pred + (y+i)*w + x, ref + (y+i+mb->mv_y)*w + x + mb->mv_x, 8);
+        }
+        else
+        {
+          memset(pred + (y+i)*w + x, 0, 8);
+        }
+      }
+    }
+  }
+
+  transform_dequantize_idct(residuals, pred, w, h, out, quanttbl);
+}
+
+static void decode_row(void *arg, int mb_row)
+{
+  transform_decode_mb_row(arg, mb_row);
+}
+
+static long count_diff(const uint8_t *a, const uint8_t *b, uint32_t size)
+{
+  long diff = 0;
+  uint32_t i;
+
+  for (i = 0; i < size; ++i)
+  {
+    if (a[i] != b[i]) { ++diff; }
+  }
+
+  return diff;
+}
+
+/* Encode src as the next frame of the stream, then decode it serially into
+   check and by macroblock rows over the pool into curframe, which becomes
+   the reference of the next frame as in the decoder. Returns the number of
+   pixels where the row decode differs from the serial one, *enc_diff gets
+   the pixels where the serial decode differs from the encoder's
+   reconstruction. */
+static long check_decode(struct c63_common *cm, struct frame *check,
+    struct pool *pool, yuv_t *src, long *enc_diff)
+{
+  struct frame *f = cm->refframe;
+  long diff = 0;
+  int c, mb_row;
+
+  cm->refframe = cm->curframe;
+  cm->curframe = f;
+  f->keyframe = cm->framenum == 0;
+
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    make_motion(f->mbs[c], cm->padw[c]/8, cm->padh[c]/8, cm->framenum);
+  }
+
+  transform_select(TRANSFORM_DEFAULT);
+
+  for (mb_row = 0; mb_row < cm->padh[Y_COMPONENT]/16; ++mb_row)
+  {
+    transform_encode_mb_row(cm, src, 0, mb_row, NULL);
+  }
+
+  int16_t *residuals[COLOR_COMPONENTS] = { f->residuals->Ydct,
+      f->residuals->Udct, f->residuals->Vdct };
+  uint8_t *refs[COLOR_COMPONENTS] = { cm->refframe->recons->Y,
+      cm->refframe->recons->U, cm->refframe->recons->V };
+  uint8_t *recons[COLOR_COMPONENTS] = { f->recons->Y, f->recons->U, f->recons->V };
+  uint8_t *pred[COLOR_COMPONENTS] = { check->predicted->Y, check->predicted->U,
+      check->predicted->V };
+  uint8_t *out[COLOR_COMPONENTS] = { check->recons->Y, check->recons->U,
+      check->recons->V };
+
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    decode_plane(residuals[c], f->keyframe ? NULL : refs[c], f->mbs[c],
+        cm->padw[c], cm->padh[c], pred[c], out[c], cm->quanttbl[c]);
+    *enc_diff += count_diff(out[c], recons[c], cm->padw[c]*cm->padh[c]);
+  }
+
+  pool_run(pool, decode_row, cm, cm->padh[Y_COMPONENT]/16);
+
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    diff += count_diff(out[c], recons[c], cm->padw[c]*cm->padh[c]);
+  }
+
+  ++cm->framenum;
+
+  return diff;
+}
+
+/* Code one block through a path and return the reconstruction */
+static void code_block(enum transform_type type, int16_t *in, int16_t *coeff,
+    int16_t *recon, uint8_t *quanttbl, struct path_stats *stats)
+{
+  struct timespec start;
+  int i;
+
+  transform_select(type);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  dct_quant_block(in, coeff, quanttbl);
+  dequant_idct_block(coeff, recon, quanttbl);
+  stats->seconds += seconds_since(&start);
+
+  for (i = 0; i < 64; ++i)
+  {
+    int16_t px = recon[i];
+
+    if (px < 0) { px = 0; }
+    else if (px > 255) { px = 255; }
+
+    recon[i] = px;
+    stats->sse += (double)(px - in[i]) * (px - in[i]);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int c, i, j;
+  uint8_t quanttbl[3][64];
+  struct path_stats ref = { 0.0, 0.0 };
+  struct path_stats fixed = { 0.0, 0.0 };
+  double sse_between = 0.0;
+  long coeff_mismatch = 0;
+  long blocks = 0;
+  int numframes = 0;
+
+  if (argc == 1) { print_help(); }
+
+  while ((c = getopt(argc, argv, "h:w:q:f:j:")) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        height = atoi(optarg);
+        break;
+      case 'w':
+        width = atoi(optarg);
+        break;
+      case 'q':
+        qp = atoi(optarg);
+        break;
+      case 'f':
+        limit_numframes = atoi(optarg);
+        break;
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      default:
+        print_help();
+        break;
+    }
+  }
+
+  if (optind >= argc || !width || !height)
+  {
+    fprintf(stderr, "Error getting program options, try --help.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  long quant_mismatch = check_quantizer();
+  printf("Reciprocal quantizer: %ld mismatches against division (q 0-255, |coeff| <= %d)\n",
+      quant_mismatch, QUANT_COEFF_MAX);
+  if (quant_mismatch) { exit(EXIT_FAILURE); }
+
+  FILE *infile = fopen(argv[optind], "rb");
+
+  if (infile == NULL)
+  {
+    perror("fopen input file");
+    exit(EXIT_FAILURE);
+  }
+
+  // Same tables as init_c63_enc
+  for (i = 0; i < 64; ++i)
+  {
+    quanttbl[0][i] = yquanttbl_def[i] / (qp / 10.0);
+    quanttbl[1][i] = uvquanttbl_def[i] / (qp / 10.0);
+    quanttbl[2][i] = uvquanttbl_def[i] / (qp / 10.0);
+  }
+
+  uint32_t plane_w[3] = { width, width/2, width/2 };
+  uint32_t plane_h[3] = { height, height/2, height/2 };
+  uint8_t *frame = malloc(width*height*3/2);
+
+  // Stream for the decode check, padded like init_c63_enc
+  struct c63_common cm;
+  memset(&cm, 0, sizeof(cm));
+  cm.width = width;
+  cm.height = height;
+  cm.padw[Y_COMPONENT] = (width + 15)/16*16;
+  cm.padh[Y_COMPONENT] = (height + 15)/16*16;
+  cm.padw[U_COMPONENT] = cm.padw[V_COMPONENT] = cm.padw[Y_COMPONENT]/2;
+  cm.padh[U_COMPONENT] = cm.padh[V_COMPONENT] = cm.padh[Y_COMPONENT]/2;
+  cm.mb_cols = cm.padw[Y_COMPONENT]/8;
+  cm.mb_rows = cm.padh[Y_COMPONENT]/8;
+  memcpy(cm.quanttbl, quanttbl, sizeof(cm.quanttbl));
+  cm.curframe = alloc_frame(&cm);
+  cm.refframe = alloc_frame(&cm);
+
+  struct frame *check = alloc_frame(&cm);
+  struct pool *pool = pool_create(num_threads);
+  long row_diff = 0, enc_diff = 0;
+  yuv_t padded;
+  uint8_t *padded_planes[3];
+
+  padded.Y = calloc(cm.padw[Y_COMPONENT]*cm.padh[Y_COMPONENT], 1);
+  padded.U = calloc(cm.padw[U_COMPONENT]*cm.padh[U_COMPONENT], 1);
+  padded.V = calloc(cm.padw[V_COMPONENT]*cm.padh[V_COMPONENT], 1);
+  padded_planes[0] = padded.Y;
+  padded_planes[1] = padded.U;
+  padded_planes[2] = padded.V;
+
+  while (fread(frame, 1, width*height*3/2, infile) == width*height*3/2)
+  {
+    uint8_t *plane = frame;
+    int component;
+
+    for (component = 0; component < 3; ++component)
+    {
+      uint32_t w = plane_w[component];
+      uint32_t h = plane_h[component];
+      uint32_t x, y;
+
+      // Partial blocks at the edges are skipped, the encoder pads them
+      for (y = 0; y + 8 <= h; y += 8)
+      {
+        for (x = 0; x + 8 <= w; x += 8)
+        {
+          int16_t in[64], coeff_f[64], coeff_i[64], recon_f[64], recon_i[64];
+
+          for (i = 0; i < 8; ++i)
+          {
+            for (j = 0; j < 8; ++j)
+            {
+              in[i*8+j] = plane[(y+i)*w + x+j];
+            }
+          }
+
+          code_block(TRANSFORM_FLOAT, in, coeff_f, recon_f, quanttbl[component], &ref);
+          code_block(TRANSFORM_INT, in, coeff_i, recon_i, quanttbl[component], &fixed);
+
+          for (i = 0; i < 64; ++i)
+          {
+            if (coeff_f[i] != coeff_i[i]) { ++coeff_mismatch; }
+            sse_between += (double)(recon_f[i] - recon_i[i]) * (recon_f[i] - recon_i[i]);
+          }
+
+          ++blocks;
+        }
+      }
+
+      for (y = 0; y < h; ++y)
+      {
+        memcpy(padded_planes[component] + y*cm.padw[component], plane + y*w, w);
+      }
+
+      plane += w*h;
+    }
+
+    row_diff += check_decode(&cm, check, pool, &padded, &enc_diff);
+
+    ++numframes;
+    if (limit_numframes && numframes >= limit_numframes) { break; }
+  }
+
+  fclose(infile);
+  free(frame);
+  free(padded.Y);
+  free(padded.U);
+  free(padded.V);
+  free_frame(cm.curframe);
+  free_frame(cm.refframe);
+  free_frame(check);
+
+  if (!blocks)
+  {
+    fprintf(stderr, "No complete frames read.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Checked %d frames, %ld blocks, qp %d\n", numframes, blocks, qp);
+  printf("  float: PSNR %.2f dB, %.1f ns/block\n",
+      psnr(ref.sse, blocks*64.0), ref.seconds*1e9/blocks);
+  printf("  int:   PSNR %.2f dB, %.1f ns/block\n",
+      psnr(fixed.sse, blocks*64.0), fixed.seconds*1e9/blocks);
+  printf("  int vs float: PSNR %.2f dB, %.3f%% coefficients differ\n",
+      psnr(sse_between, blocks*64.0), 100.0*coeff_mismatch/(blocks*64.0));
+  printf("Row decode over %d threads (%s DCT): %ld pixels differ from the serial decode, %ld from the encoder\n",
+      pool_size(pool), transform_name(TRANSFORM_DEFAULT), row_diff, enc_diff);
+
+  pool_destroy(pool);
+
+  if (row_diff || enc_diff) { exit(EXIT_FAILURE); }
+
+  return EXIT_SUCCESS;
+}
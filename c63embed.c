@@ -0,0 +1,339 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libc63.h"
+
+/* Drives libc63 the way an embedding program would. A yuv file is encoded
+   once polling for packets and once with a packet callback. Both have to
+   give the same stream in submission order, and no more than
+   max_in_flight frames may ever be submitted but not delivered. */
+
+static uint32_t width;
+static uint32_t height;
+static int limit_numframes = 0;
+static int max_in_flight = 2;
+static int slow_ms = 0;
+static enum c63_transform transform = C63_DCT_DEFAULT;
+static enum c63_chroma_mv chroma_mv = C63_CHROMA_SEARCH;
+static char *output_file;
+
+/* getopt */
+extern int optind;
+extern char *optarg;
+
+/* A stream as it came out of the encoder, plus what was checked on the
+   way */
+struct run
+{
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  int frames;
+  int keyframes;
+  int order_errors;     //packet with an unexpected tag or frame number
+  int max_seen;         //most frames in flight seen after a submit
+  double seconds;
+};
+
+/* Padded planes of one frame, a ring of max_in_flight + 1 of them is
+   enough: a buffer is refilled only after the frame that used it
+   max_in_flight + 1 frames earlier has been delivered */
+struct buffer
+{
+  uint8_t *planes[3];
+};
+
+static pthread_mutex_t delivered_lock = PTHREAD_MUTEX_INITIALIZER;
+static int delivered;   //packets handed to on_packet so far
+
+static void print_help()
+{
+  printf("Usage: ./c63embed [options] input_file\n");
+  printf("Commandline options:\n");
+  printf("  -h                             Height of images\n");
+  printf("  -w                             Width of images\n");
+  printf("  [-f]                           Limit number of frames to encode\n");
+  printf("  [-j]                           Frames in flight (default 2)\n");
+  printf("  [-s]                           Sleep this many ms in on_packet, to make submit block\n");
+  printf("  [-d]                           DCT to use, float or int\n");
+  printf("  [-M]                           Chroma motion vectors: search, derive or refine\n");
+  printf("  [-o]                           Write the stream of the poll run to this file\n");
+  printf("\n");
+
+  exit(EXIT_FAILURE);
+}
+
+static double seconds_since(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1e9;
+}
+
+static void append(struct run *run, const struct c63_packet *packet)
+{
+  if (packet->tag != (void *)(intptr_t)run->frames || packet->frame != run->frames)
+  {
+    ++run->order_errors;
+  }
+
+  if (run->size + packet->size > run->capacity)
+  {
+    run->capacity = (run->size + packet->size)*2;
+    run->data = realloc(run->data, run->capacity);
+  }
+
+  memcpy(run->data + run->size, packet->data, packet->size);
+  run->size += packet->size;
+  run->keyframes += packet->keyframe;
+  ++run->frames;
+}
+
+static void on_packet(void *opaque, const struct c63_packet *packet)
+{
+  struct timespec pause = { slow_ms/1000, (slow_ms%1000)*1000000L };
+
+  append(opaque, packet);
+
+  if (slow_ms) { nanosleep(&pause, NULL); }
+
+  pthread_mutex_lock(&delivered_lock);
+  ++delivered;
+  pthread_mutex_unlock(&delivered_lock);
+}
+
+/* Read the next frame of the file into the padded planes of buf */
+static int read_frame(FILE *file, struct c63_encoder *enc, struct buffer *buf)
+{
+  uint32_t plane_w[3] = { width, width/2, width/2 };
+  uint32_t plane_h[3] = { height, height/2, height/2 };
+  uint32_t y;
+  int c, pw, ph;
+
+  for (c = 0; c < 3; ++c)
+  {
+    c63_encoder_plane_size(enc, c, &pw, &ph);
+
+    for (y = 0; y < plane_h[c]; ++y)
+    {
+      if (fread(buf->planes[c] + y*pw, 1, plane_w[c], file) != plane_w[c])
+      {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/* Encode the file through one encoder, polling for packets if poll is
+   set, otherwise through on_packet */
+static void encode(const char *input_file, int poll, struct run *run)
+{
+  struct c63_params params;
+  struct c63_encoder *enc;
+  struct c63_packet packet;
+  struct buffer *bufs;
+  struct timespec start;
+  FILE *infile;
+  int c, i, pw, ph;
+  int submitted = 0;
+
+  memset(run, 0, sizeof(*run));
+  delivered = 0;
+
+  memset(&params, 0, sizeof(params));
+  params.width = width;
+  params.height = height;
+  params.transform = transform;
+  params.chroma_mv = chroma_mv;
+  params.max_in_flight = max_in_flight;
+  params.on_packet = poll ? NULL : on_packet;
+  params.opaque = run;
+
+  enc = c63_encoder_open(&params, C63_BACKEND_LOCAL);
+  if (!enc)
+  {
+    perror("c63_encoder_open");
+    exit(EXIT_FAILURE);
+  }
+
+  infile = fopen(input_file, "rb");
+  if (infile == NULL)
+  {
+    perror("fopen input file");
+    exit(EXIT_FAILURE);
+  }
+
+  bufs = calloc(max_in_flight + 1, sizeof(struct buffer));
+  for (i = 0; i <= max_in_flight; ++i)
+  {
+    for (c = 0; c < 3; ++c)
+    {
+      c63_encoder_plane_size(enc, c, &pw, &ph);
+      bufs[i].planes[c] = calloc(pw*ph, 1);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (!limit_numframes || submitted < limit_numframes)
+  {
+    struct buffer *buf = &bufs[submitted % (max_in_flight + 1)];
+    int in_flight;
+
+    if (poll)
+    {
+      // take what is done, and wait when a submit would block
+      while (c63_poll_packets(enc, &packet, submitted - run->frames == max_in_flight))
+      {
+        append(run, &packet);
+        c63_packet_free(&packet);
+      }
+    }
+
+    if (!read_frame(infile, enc, buf)) { break; }
+
+    if (c63_submit_frame(enc, buf->planes[0], buf->planes[1], buf->planes[2],
+        (void *)(intptr_t)submitted))
+    {
+      fprintf(stderr, "c63_submit_frame failed\n");
+      exit(EXIT_FAILURE);
+    }
+    ++submitted;
+
+    /* submit only returns with room for the frame, so no more than
+       max_in_flight can be waiting for delivery now */
+    if (poll)
+    {
+      in_flight = submitted - run->frames;
+    }
+    else
+    {
+      pthread_mutex_lock(&delivered_lock);
+      in_flight = submitted - delivered;
+      pthread_mutex_unlock(&delivered_lock);
+    }
+    if (in_flight > run->max_seen) { run->max_seen = in_flight; }
+  }
+
+  while (poll && c63_poll_packets(enc, &packet, 1))
+  {
+    append(run, &packet);
+    c63_packet_free(&packet);
+  }
+
+  c63_encoder_close(enc);
+  run->seconds = seconds_since(&start);
+
+  fclose(infile);
+  for (i = 0; i <= max_in_flight; ++i)
+  {
+    for (c = 0; c < 3; ++c) { free(bufs[i].planes[c]); }
+  }
+  free(bufs);
+
+  if (run->frames != submitted) { ++run->order_errors; }
+}
+
+static void report(const char *name, struct run *run)
+{
+  printf("  %s: %d frames (%d keyframes), %zu bytes, %.1f fps, at most %d of %d in flight, %d out of order\n",
+      name, run->frames, run->keyframes, run->size, run->frames/run->seconds,
+      run->max_seen, max_in_flight, run->order_errors);
+}
+
+int main(int argc, char **argv)
+{
+  struct run polled, called;
+  int c, same, ok;
+
+  if (argc == 1) { print_help(); }
+
+  while ((c = getopt(argc, argv, "h:w:f:j:s:d:M:o:")) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        height = atoi(optarg);
+        break;
+      case 'w':
+        width = atoi(optarg);
+        break;
+      case 'f':
+        limit_numframes = atoi(optarg);
+        break;
+      case 'j':
+        max_in_flight = atoi(optarg);
+        break;
+      case 's':
+        slow_ms = atoi(optarg);
+        break;
+      case 'd':
+        if (!strcmp(optarg, "float")) { transform = C63_DCT_FLOAT; }
+        else if (!strcmp(optarg, "int")) { transform = C63_DCT_INT; }
+        else { print_help(); }
+        break;
+      case 'M':
+        if (!strcmp(optarg, "search")) { chroma_mv = C63_CHROMA_SEARCH; }
+        else if (!strcmp(optarg, "derive")) { chroma_mv = C63_CHROMA_DERIVE; }
+        else if (!strcmp(optarg, "refine")) { chroma_mv = C63_CHROMA_REFINE; }
+        else { print_help(); }
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      default:
+        print_help();
+        break;
+    }
+  }
+
+  if (optind >= argc || !width || !height || max_in_flight < 1)
+  {
+    fprintf(stderr, "Error getting program options, try --help.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  encode(argv[optind], 1, &polled);
+  encode(argv[optind], 0, &called);
+
+  if (!polled.frames)
+  {
+    fprintf(stderr, "No complete frames read.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  same = polled.size == called.size && !memcmp(polled.data, called.data, polled.size);
+  ok = same && !polled.order_errors && !called.order_errors &&
+      polled.max_seen <= max_in_flight && called.max_seen <= max_in_flight;
+
+  printf("Encoded %s through libc63\n", argv[optind]);
+  report("poll", &polled);
+  report("callback", &called);
+  printf("  streams %s\n", same ? "identical" : "differ");
+
+  if (output_file)
+  {
+    FILE *outfile = fopen(output_file, "wb");
+
+    if (outfile == NULL)
+    {
+      perror("fopen output file");
+      exit(EXIT_FAILURE);
+    }
+    fwrite(polled.data, 1, polled.size, outfile);
+    fclose(outfile);
+  }
+
+  free(polled.data);
+  free(called.data);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -8,12 +8,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include<time.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <sisci_error.h>
 #include <sisci_api.h>
 #include "c63.h"
 #include "c63_write.h"
 #include "common.h"
 #include "tables.h"
+#include "affinity.h"
+#include "alloc.h"
+#include "delta.h"
+#include "dma.h"
+#include "tile.h"
+#include "perf.h"
+#include "trace.h"
+#include "tune.h"
+#include "transform.h"
 
 static char *output_file, *input_file;
 FILE *outfile;
@@ -23,6 +34,38 @@ static int limit_numframes = 0;
 static uint32_t width;
 static uint32_t height;
 static uint32_t remote_node = 0;
+static int session = 0;
+static enum layout layout = LAYOUT_RASTER;
+static enum transform_type transform = TRANSFORM_DEFAULT;
+static int stream_rows = 0;
+static enum alloc_mode memory = ALLOC_DEFAULT;
+static struct affinity affinity;
+
+/* DMA tuning, chunk size 0 sends every plane as one transfer. Each value
+   not set on the command line comes from the autotune cache */
+static size_t dma_chunk = 0;
+static int dma_queues = 1;
+static int dma_sweep_run = 0;
+static int dma_chunk_set = 0;
+static int dma_queues_set = 0;
+static int pio_threshold_set = 0;
+static int autotune = 0;
+
+/* Transfers below this many bytes are written with PIO, -1 measures the
+   crossover at startup */
+static int pio_threshold = -1;
+
+// Send only the 8x8 blocks that changed since the previous frame
+static int delta_input = 0;
+
+/* Live mode. A latency target (ms) turns on per frame flushing and latency
+   tracking, frame_rate gives the nominal capture clock of the source */
+static double latency_target = 0.0;
+static int frame_rate = 0;
+static enum { POLICY_BLOCK, POLICY_DROP } policy = POLICY_BLOCK;
+
+/* Progress messages, moved to stderr when the stream goes to stdout */
+static FILE *msg;
 
 //time measurement
 double elapsed;
@@ -33,24 +76,46 @@ struct timespec end_time;
 extern int optind;
 extern char *optarg;
 
-/* Read planar YUV frames with 4:2:0 chroma sub-sampling */
-static yuv_t* read_yuv(FILE *file, struct c63_common *cm)
+static double timestamp(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Whether more input is already waiting on a pipe or device, meaning the
+   source is a frame or more ahead of the encoder. A regular file is
+   always readable and never counts as a backlog. */
+static int input_backlog(FILE *file)
+{
+  struct pollfd pfd;
+  struct stat st;
+
+  if (fstat(fileno(file), &st) || S_ISREG(st.st_mode)) { return 0; }
+
+  pfd.fd = fileno(file);
+  pfd.events = POLLIN;
+
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+/* Read planar YUV frames with 4:2:0 chroma sub-sampling into image, whose
+   planes are allocated once with the padded size. Returns NULL at the end
+   of the input. */
+static yuv_t* read_yuv(FILE *file, yuv_t *image)
 {
   size_t len = 0;
-  yuv_t *image = malloc(sizeof(*image));
 
   /* Read Y. The size of Y is the same as the size of the image. The indices
      represents the color component (0 is Y, 1 is U, and 2 is V) */
-  image->Y = calloc(1, cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
   len += fread(image->Y, 1, width*height, file);
 
   /* Read U. Given 4:2:0 chroma sub-sampling, the size is 1/4 of Y
      because (height/2)*(width/2) = (height*width)/4. */
-  image->U = calloc(1, cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
   len += fread(image->U, 1, (width*height)/4, file);
 
   /* Read V. Given 4:2:0 chroma sub-sampling, the size is 1/4 of Y. */
-  image->V = calloc(1, cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
   len += fread(image->V, 1, (width*height)/4, file);
 
   if (ferror(file))
@@ -61,11 +126,6 @@ static yuv_t* read_yuv(FILE *file, struct c63_common *cm)
 
   if (feof(file))
   {
-    free(image->Y);
-    free(image->U);
-    free(image->V);
-    free(image);
-
     return NULL;
   }
   else if (len != width*height*1.5)
@@ -73,11 +133,6 @@ static yuv_t* read_yuv(FILE *file, struct c63_common *cm)
     fprintf(stderr, "Reached end of file, but incorrect bytes read.\n");
     fprintf(stderr, "Wrong input? (height: %d width: %d)\n", height, width);
 
-    free(image->Y);
-    free(image->U);
-    free(image->V);
-    free(image);
-
     return NULL;
   }
 
@@ -126,13 +181,31 @@ struct c63_common* init_c63_enc(int width, int height)
 
 static void print_help()
 {
-  printf("Usage: ./c63enc [options] input_file\n");
+  printf("Usage: ./c63enc [options] input_file ('-' for stdin)\n");
   printf("Commandline options:\n");
   printf("  -h                             Height of images to compress\n");
   printf("  -w                             Width of images to compress\n");
-  printf("  -o                             Output file (.c63)\n");
+  printf("  -o                             Output file (.c63), '-' for stdout\n");
   printf("  -r                             Node id of server\n");
   printf("  [-f]                           Limit number of frames to encode\n");
+  printf("  [-t]                           Send planes in 8x8 block-tiled layout\n");
+  printf("  [-s]                           Copy results out by macroblock row while the frame is encoded\n");
+  printf("  [-x]                           Send only changed 8x8 blocks of each frame\n");
+  printf("  [-C]                           DMA chunk size in KiB (default whole planes)\n");
+  printf("  [-Q]                           Number of DMA queues (default 1)\n");
+  printf("  [-D]                           Run a DMA chunk/queue sweep first\n");
+  printf("  [-A]                           Autotune transfers and cache the result\n");
+  printf("  [-P]                           PIO below this many bytes, 0 never (default calibrated)\n");
+  printf("  [-m]                           Frame memory: none, thp or huge (pages)\n");
+  printf("  [-S]                           Session 0-%d, to run several streams against one server\n", MAX_SESSIONS - 1);
+  printf("  [-T]                           Write a timeline trace to this file\n");
+  printf("  [-E]                           Hardware counters per stage, e.g. cycles,instructions,l1d,llc,branch,dtlb or all\n");
+  printf("  [-l]                           Live mode, per frame latency target in ms\n");
+  printf("  [-b]                           Live backpressure policy, block or drop\n");
+  printf("  [-F]                           Live source frame rate (capture clock)\n");
+  printf("  [-d]                           DCT to use, float or int (default %s)\n",
+      transform_name(TRANSFORM_DEFAULT));
+  affinity_help();
   printf("\n");
 
   exit(EXIT_FAILURE);
@@ -150,11 +223,8 @@ int main(int argc, char **argv)
   size_t localOffset = 0;
   size_t remoteOffset = 0;
   
-  /* DMA queue for image */
-  sci_dma_queue_t	dmaq;         
-  
-  /* maximum entries inside dmaq */  
-  unsigned int maxEntries = 1; 
+  /* DMA queues for image */
+  struct dma dma;
 
   /* segments for the y, u, v transfer from x86 */
   sci_remote_segment_t remote_segment;
@@ -179,7 +249,7 @@ int main(int argc, char **argv)
 
   if (argc == 1) { print_help(); }
 
-  while ((c = getopt(argc, argv, "h:w:o:f:i:r:")) != -1)
+  while ((c = getopt(argc, argv, "h:w:o:f:i:r:td:sxl:b:F:m:c:W:I:p:C:Q:DAP:T:E:S:")) != -1)
   {
     switch (c)
     {
@@ -198,7 +268,72 @@ int main(int argc, char **argv)
       case 'r':
         remote_node = atoi(optarg);
         break;
+      case 't':
+        layout = LAYOUT_TILED;
+        break;
+      case 's':
+        stream_rows = 1;
+        break;
+      case 'l':
+        latency_target = atof(optarg);
+        break;
+      case 'b':
+        if (!strcmp(optarg, "block")) { policy = POLICY_BLOCK; }
+        else if (!strcmp(optarg, "drop")) { policy = POLICY_DROP; }
+        else
+        {
+          fprintf(stderr, "Unknown backlog policy %s, use block or drop\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'F':
+        frame_rate = atoi(optarg);
+        break;
+      case 'm':
+        memory = alloc_parse_mode(optarg);
+        break;
+      case 'C':
+        dma_chunk = atoi(optarg) * 1024;
+        dma_chunk_set = 1;
+        break;
+      case 'Q':
+        dma_queues = atoi(optarg);
+        dma_queues_set = 1;
+        break;
+      case 'x':
+        delta_input = 1;
+        break;
+      case 'T':
+        trace_init(optarg, "c63enc (x86)", 1);
+        break;
+      case 'E':
+        perf_init(optarg);
+        break;
+      case 'S':
+        session = atoi(optarg);
+        if (session < 0 || session >= MAX_SESSIONS) { print_help(); }
+        break;
+      case 'D':
+        dma_sweep_run = 1;
+        break;
+      case 'A':
+        autotune = 1;
+        break;
+      case 'P':
+        pio_threshold = atoi(optarg);
+        pio_threshold_set = 1;
+        break;
+      case 'd':
+        if (!strcmp(optarg, "float")) { transform = TRANSFORM_FLOAT; }
+        else if (!strcmp(optarg, "int")) { transform = TRANSFORM_INT; }
+        else
+        {
+          fprintf(stderr, "Unknown DCT %s, use float or int\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
       default:
+        if (affinity_option(&affinity, c, optarg)) { break; }
         print_help();
         break;
     }
@@ -210,7 +345,23 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  outfile = fopen(output_file, "wb");
+  if (delta_input && layout == LAYOUT_TILED)
+  {
+    fprintf(stderr, "Delta input (-x) sends raster planes, it can not be combined with -t.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  msg = stdout;
+
+  if (output_file && !strcmp(output_file, "-"))
+  {
+    outfile = stdout;
+    msg = stderr;
+  }
+  else
+  {
+    outfile = fopen(output_file, "wb");
+  }
 
   if (outfile == NULL)
   {
@@ -218,14 +369,28 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
+  /* The main thread spins on the control segment, drives the DMA and
+     also does the file io */
+  affinity_apply_control(&affinity);
+  affinity_log_config(msg, &affinity);
+  affinity_log(msg, "Control");
+
+  alloc_init(memory);
+  perf_open();
+
   struct c63_common *cm = init_c63_enc(width, height);
   cm->e_ctx.fp = outfile;
 
   input_file = argv[optind];
 
-  if (limit_numframes) { printf("Limited to %d frames.\n", limit_numframes); }
+  if (limit_numframes) { fprintf(msg, "Limited to %d frames.\n", limit_numframes); }
+  if (transform != TRANSFORM_DEFAULT)
+  {
+    fprintf(stderr, "Using %s DCT, decode with a matching 'make TRANSFORM=%s' build.\n",
+        transform_name(transform), transform_name(transform));
+  }
 
-  FILE *infile = fopen(input_file, "rb");
+  FILE *infile = strcmp(input_file, "-") ? fopen(input_file, "rb") : stdin;
 
   if (infile == NULL)
   {
@@ -233,6 +398,9 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
+  // queued input has to be visible to input_backlog, not sit in stdio's buffer
+  if (latency_target && policy == POLICY_DROP) { setvbuf(infile, NULL, _IONBF, 0); }
+
   /* Initialize SISCI */
   SCIInitialize(0, &error);
   if (error != SCI_ERR_OK) {
@@ -258,6 +426,10 @@ int main(int argc, char **argv)
     int16_t *Ydct[cm->ypw * cm->yph]; 
     int16_t *Udct[cm->upw * cm->uph];
     int16_t *Vdct[cm->vpw * cm->vph];
+    /* A byte per block, 0 if it has no coefficients, else 1 + the zigzag
+       index of the last nonzero one (see transform.h). Streamed along with
+       the residual rows */
+    uint8_t nz[COLOR_COMPONENTS][cm->mb_rows * cm->mb_cols];
   } *result_local_img_seg;
 
   /* file descriptor */
@@ -271,7 +443,7 @@ int main(int argc, char **argv)
   //create segment
   SCICreateSegment(v_dev,
                    &local_packets,
-                   SEGMENT_LOCAL_COM,
+                   SEGMENT_LOCAL_COM(session),
                    sizeof(struct com_packets),
                    NO_CALLBACK,
                    NULL,
@@ -303,7 +475,7 @@ int main(int argc, char **argv)
       SCIConnectSegment(v_dev,
                         &remote_packets,
                         remote_node,
-                        SEGMENT_REMOTE_COM,
+                        SEGMENT_REMOTE_COM(session),
                         local_adapter_num,
                         NO_CALLBACK,
                         NULL,
@@ -349,16 +521,28 @@ int main(int argc, char **argv)
   *   and set cmd==CMD_DONE so that it can stop waiting  */
   local_packets->packet.img_width = width;
   local_packets->packet.img_height = height;
+  local_packets->packet.layout = layout;
+  local_packets->packet.transform = transform;
+  local_packets->packet.stream = stream_rows;
   local_packets->packet.cmd = CMD_DONE;
 
+  // with huge pages the segments are backed by our own pinned memory
+  void *img_mem = NULL;
+  void *result_mem = NULL;
+  if (memory != ALLOC_DEFAULT)
+  {
+    img_mem = c63_alloc(sizeof(struct img_segment));
+    result_mem = c63_alloc(sizeof(struct result_img_segment));
+  }
+
   //create local segment for available image data
   SCICreateSegment(v_dev,
                    &local_segment,
-                   SEGMENT_LOCAL,
+                   SEGMENT_LOCAL(session),
                    sizeof(struct img_segment),
                    NO_CALLBACK,
                    NULL,
-                   NO_FLAGS,
+                   img_mem ? SCI_FLAG_EMPTY : NO_FLAGS,
                    &error);
   if(error != SCI_ERR_OK){
    fprintf(stderr, "SCICreateSegment failed: %s - Error code: (0x%x)\n",
@@ -366,6 +550,16 @@ int main(int argc, char **argv)
    exit(EXIT_FAILURE);
   }
 
+  if (img_mem)
+  {
+    SCIRegisterSegmentMemory(img_mem, sizeof(struct img_segment), local_segment, NO_FLAGS, &error);
+    if(error != SCI_ERR_OK){
+     fprintf(stderr, "SCIRegisterSegmentMemory failed: %s - Error code: (0x%x)\n",
+             SCIGetErrorString(error), error);
+     exit(EXIT_FAILURE);
+    }
+  }
+
   //preaper segment
   SCIPrepareSegment(local_segment, local_adapter_num, NO_FLAGS, &error);
   if(error != SCI_ERR_OK){
@@ -384,11 +578,11 @@ int main(int argc, char **argv)
   //create segment for results
   SCICreateSegment(v_dev,
                   &result_local_segment,
-                  SEGMENT_LOCAL_RESULT,
+                  SEGMENT_LOCAL_RESULT(session),
                   sizeof(struct result_img_segment),
                   NO_CALLBACK,
                   NULL,
-                  NO_FLAGS,
+                  result_mem ? SCI_FLAG_EMPTY : NO_FLAGS,
                   &error);
   if(error != SCI_ERR_OK){
     fprintf(stderr, "SCICreateSegment failed: %s - Error code: (0x%x)\n",
@@ -396,6 +590,16 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
+  if (result_mem)
+  {
+    SCIRegisterSegmentMemory(result_mem, sizeof(struct result_img_segment), result_local_segment, NO_FLAGS, &error);
+    if(error != SCI_ERR_OK){
+      fprintf(stderr, "SCIRegisterSegmentMemory failed: %s - Error code: (0x%x)\n",
+              SCIGetErrorString(error), error);
+      exit(EXIT_FAILURE);
+    }
+  }
+
   //prepare result segment
   SCIPrepareSegment(result_local_segment, local_adapter_num, NO_FLAGS, &error);
   if(error != SCI_ERR_OK){
@@ -416,7 +620,7 @@ int main(int argc, char **argv)
      SCIConnectSegment(v_dev,
                        &remote_segment,
                        remote_node,
-                       SEGMENT_REMOTE,
+                       SEGMENT_REMOTE(session),
                        local_adapter_num,
                        NO_CALLBACK,
                        NULL,
@@ -453,38 +657,127 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  //Creating DMA queue for transfer
-  SCICreateDMAQueue(v_dev,
-                    &dmaq,
-                    local_adapter_num,
-                    maxEntries,
-                    NO_FLAGS,
-                    &error
-                  );
+  // planes only use the start of their slot in img_segment
+  size_t plane_offset[COLOR_COMPONENTS] = {
+    (uint8_t *)local_img_seg->Y - (uint8_t *)local_img_seg,
+    (uint8_t *)local_img_seg->U - (uint8_t *)local_img_seg,
+    (uint8_t *)local_img_seg->V - (uint8_t *)local_img_seg };
+  size_t full_plane_size[COLOR_COMPONENTS] = {
+    cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT],
+    cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT],
+    cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT] };
+  struct dma_transfer plane_xfer[COLOR_COMPONENTS];
+
+  /* Transfer parameters come from the command line, the autotune cache or
+     a new search, in that order */
+  unsigned int local_node = 0;
+  char tune_id[64];
+  struct tune tune;
+
+  SCIGetLocalNodeId(local_adapter_num, &local_node, NO_FLAGS, &error);
   if(error != SCI_ERR_OK){
-    fprintf(stderr, "SCICreateDMAQueue failed: %s - Error code: (0x%x)\n",
-    SCIGetErrorString(error), error);
+    fprintf(stderr, "SCIGetLocalNodeId failed: %s - Error code: (0x%x)\n",
+            SCIGetErrorString(error), error);
     exit(EXIT_FAILURE);
   }
+  tune_key(tune_id, sizeof(tune_id), width, height, local_node, remote_node);
+
+  if (autotune || dma_sweep_run)
+  {
+    tune_search(&tune, v_dev, local_adapter_num, local_segment, remote_segment,
+        (void *)local_img_seg, sizeof(struct img_segment), plane_offset,
+        full_plane_size, dma_sweep_run ? msg : NULL);
+    if (autotune) { tune_save(TUNE_CACHE, tune_id, &tune); }
+  }
+  else if (!tune_load(TUNE_CACHE, tune_id, &tune))
+  {
+    tune.dma_chunk = dma_chunk;
+    tune.dma_queues = dma_queues;
+    tune.pio_threshold = pio_threshold;
+  }
+
+  if (!dma_chunk_set) { dma_chunk = tune.dma_chunk; }
+  if (!dma_queues_set) { dma_queues = tune.dma_queues; }
+  if (!pio_threshold_set) { pio_threshold = tune.pio_threshold; }
+  fprintf(msg, "Transfers for %s: %d DMA queues, %zu KiB chunks\n", tune_id,
+      dma_queues, dma_chunk/1024);
+
+  //Creating DMA queues for transfer
+  dma_init(&dma, v_dev, local_adapter_num, dma_queues, dma_chunk);
+
+  // small planes are cheaper to write directly into the Tegra's memory
+  dma_map_pio(&dma, local_segment, (void *)local_img_seg, remote_segment,
+      sizeof(struct img_segment));
+  dma.pio_threshold = pio_threshold >= 0 ? (size_t)pio_threshold :
+      dma_calibrate(&dma, local_segment, cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
+  fprintf(msg, "PIO below %zu bytes\n", dma.pio_threshold);
+
+  /* The server sets up its side once these are final. It calibrates its
+     own PIO threshold unless one was given with -P */
+  local_packets->packet.dma_chunk = dma_chunk;
+  local_packets->packet.dma_queues = dma_queues;
+  local_packets->packet.pio_threshold = pio_threshold_set ? pio_threshold : -1;
+  local_packets->packet.server_ready = 0;
+  local_packets->packet.dma_ready = 1;
+
+  /* The server calibrates its result transfers before it looks at the
+     segment again, a frame or ping sent earlier would skew both timings */
+  while (!local_packets->packet.server_ready);
 
   // create cm to write in c63_write
   cm->curframe = malloc(sizeof(struct frame));
   cm->curframe ->residuals = malloc(sizeof(dct_t));
 
   //Y
-  cm->curframe ->residuals->Ydct = calloc(cm->ypw * cm->yph, sizeof(int16_t));
+  cm->curframe ->residuals->Ydct = c63_alloc(cm->ypw * cm->yph * sizeof(int16_t));
   //U
-  cm->curframe ->residuals->Udct = calloc(cm->upw * cm->uph, sizeof(int16_t));
+  cm->curframe ->residuals->Udct = c63_alloc(cm->upw * cm->uph * sizeof(int16_t));
   //V
-  cm->curframe ->residuals->Vdct = calloc(cm->vpw * cm->vph, sizeof(int16_t));
+  cm->curframe ->residuals->Vdct = c63_alloc(cm->vpw * cm->vph * sizeof(int16_t));
 
   //Memory allocation for Y,U,V components
-  cm->curframe ->mbs[Y_COMPONENT] = calloc(cm->mb_rows * cm->mb_cols, sizeof(struct macroblock));
-  cm->curframe ->mbs[U_COMPONENT] = calloc(cm->mb_rows/2 * cm->mb_cols/2, sizeof(struct macroblock));
-  cm->curframe ->mbs[V_COMPONENT] = calloc(cm->mb_rows/2 * cm->mb_cols/2, sizeof(struct macroblock));
+  cm->curframe ->mbs[Y_COMPONENT] = c63_alloc(cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));
+  cm->curframe ->mbs[U_COMPONENT] = c63_alloc(cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+  cm->curframe ->mbs[V_COMPONENT] = c63_alloc(cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+
+  // input frame, reused for every frame
+  yuv_t input;
+  input.Y = c63_alloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
+  input.U = c63_alloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
+  input.V = c63_alloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
+
+  // last frame sent, delta input is computed against it
+  yuv_t prev;
+  prev.Y = prev.U = prev.V = NULL;
+  if (delta_input)
+  {
+    prev.Y = c63_alloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
+    prev.U = c63_alloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
+    prev.V = c63_alloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
+  }
+
+  if (memory != ALLOC_DEFAULT) { alloc_report(msg, "Setup"); }
 
 
   int numframes = 0;
+  int frames_since_full = 0;
+  size_t sent_bytes = 0;
+  size_t full_bytes = 0;
+
+  // live mode bookkeeping
+  int frames_in = 0;
+  int dropped = 0;
+  int late = 0;
+  int force_keyframe = 0;
+  double first_capture = 0.0;
+  double last_latency = 0.0;
+  double encode_ms = 0.0;      //send to written, of the last encoded frame
+  double total_latency = 0.0;
+  double max_latency = 0.0;
+
+  // server events are shifted onto our clock when traced
+  if (trace_enabled()) { trace_sync_client(local_packets, remote_packets, 100); }
+
   // start time
   clock_gettime(CLOCK_MONOTONIC, &start_time);
 
@@ -496,68 +789,209 @@ int main(int argc, char **argv)
   {
     //set CMD to INVALID
     local_packets->packet.cmd = CMD_INVALID;
-    image = read_yuv(infile, cm);
+    local_packets->packet.rows_done = 0;
+    trace_begin("read");
+    perf_begin("read");
+    image = read_yuv(infile, &input);
+    perf_end("read");
+    trace_end("read");
     if (!image) { break; }
 
+    /* Capture time is the nominal frame clock when the rate is known,
+       otherwise the moment the frame arrived */
+    double capture = timestamp();
+    if (frame_rate)
+    {
+      if (!frames_in) { first_capture = capture; }
+      capture = first_capture + (double)frames_in / frame_rate;
+    }
+    ++frames_in;
+
+    /* Drop only on a real backlog. Against the capture clock a frame is
+       late if its lag so far plus the last encode time misses the target.
+       Without one the arrival time says nothing about how long a frame
+       waited, so it is late when the next frame is already queued. */
+    if (latency_target && policy == POLICY_DROP &&
+        (frame_rate ? (timestamp() - capture)*1000.0 + encode_ms > latency_target
+                    : input_backlog(infile)))
+    {
+      // behind, skip this frame and restart prediction on the next one
+      ++dropped;
+      force_keyframe = 1;
+      continue;
+    }
+
+    double encode_start = timestamp();
+
+    local_packets->packet.force_keyframe = force_keyframe;
+    force_keyframe = 0;
+
+    /* With delta input, full planes are still sent for the first frame,
+       at the keyframe interval and after drops, so the server's copy is
+       rebuilt from scratch regularly */
+    int full = !delta_input || numframes == 0 || local_packets->packet.force_keyframe ||
+        frames_since_full >= cm->keyframe_interval;
+    uint8_t planes_delta = 0;
+    size_t plane_size[COLOR_COMPONENTS];
+    uint8_t *in_planes[COLOR_COMPONENTS] = { image->Y, image->U, image->V };
+    uint8_t *prev_planes[COLOR_COMPONENTS] = { prev.Y, prev.U, prev.V };
+    uint8_t *seg_planes[COLOR_COMPONENTS] = { (uint8_t *)local_img_seg->Y,
+        (uint8_t *)local_img_seg->U, (uint8_t *)local_img_seg->V };
+
+    frames_since_full = full ? 1 : frames_since_full + 1;
+
     //Copying memory blocks from image to client segment
-    memcpy(local_img_seg->Y, image->Y, cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
-    memcpy(local_img_seg->U, image->U, cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
-    memcpy(local_img_seg->V, image->V, cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
-
-    // Starting DMA transfer using DMA queue
-    SCIStartDmaTransfer(dmaq,
-                        local_segment,
-                        remote_segment,
-                        localOffset,
-                        sizeof(struct img_segment),
-                        remoteOffset,
-                        NO_CALLBACK,
-                        NULL,
-                        NO_FLAGS,
-                        &error);
+    trace_begin("copy");
+    perf_begin("copy");
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      plane_size[c] = cm->padw[c]*cm->padh[c];
+
+      if (layout == LAYOUT_TILED)
+      {
+        // 8x8 blocks become contiguous, so the server reads one run per block
+        tile_plane(seg_planes[c], in_planes[c], cm->padw[c], cm->padh[c]);
+      }
+      else if (!full && (plane_size[c] = delta_pack(seg_planes[c], prev_planes[c],
+          in_planes[c], cm->padw[c], cm->padh[c])))
+      {
+        planes_delta |= 1 << c;
+      }
+      else
+      {
+        plane_size[c] = cm->padw[c]*cm->padh[c];
+        memcpy(seg_planes[c], in_planes[c], plane_size[c]);
+        if (delta_input) { memcpy(prev_planes[c], in_planes[c], plane_size[c]); }
+      }
+
+      sent_bytes += plane_size[c];
+      full_bytes += cm->padw[c]*cm->padh[c];
+    }
+    perf_end("copy");
+    trace_end("copy");
 
-    if(error != SCI_ERR_OK){
-      fprintf(stderr, "SCIStartDmaTransfer failed: %s - Error code: (0x%x)\n",
-      SCIGetErrorString(error), error);
-      exit(EXIT_FAILURE);
+    /* One transfer per plane. The server is told to start as soon as Y
+       has landed and picks up U and V as their bits in planes_ready are set */
+    remote_packets->packet.planes_ready = 0;
+    remote_packets->packet.planes_delta = planes_delta;
+
+    trace_begin("send");
+    perf_begin("send");
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      dma_transfer_init(&dma, &plane_xfer[c]);
+      dma_start(&plane_xfer[c], local_segment, remote_segment, plane_offset[c],
+          plane_offset[c], plane_size[c]);
     }
 
-    // Waiting for DMA to finish transfer
-    SCIWaitForDMAQueue(dmaq,
-                      SCI_INFINITE_TIMEOUT,
-                      NO_FLAGS,
-                      &error);
-    if(error != SCI_ERR_OK){
-      fprintf(stderr, "SCIWaitForDMAQueue failed: %s - Error code: (0x%x)\n",
-      SCIGetErrorString(error), error);
-      exit(EXIT_FAILURE);
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      dma_transfer_wait(&plane_xfer[c]);
+      remote_packets->packet.planes_ready |= 1 << c;
+
+      if (c == Y_COMPONENT)
+      {
+        fprintf(msg, "Encoding frame %d, ", numframes);
+
+        //Telling Tegra to start encoding
+        remote_packets->packet.cmd = CMD_DONE;
+      }
     }
-    printf("Encoding frame %d, ", numframes);
-    
-    //Telling Tegra to start encoding
-    
-    remote_packets->packet.cmd = CMD_DONE;
+    perf_end("send");
+    trace_end("send");
 
-    // Waiting for Tegra to finish encoding
-    while(local_packets->packet.cmd != CMD_DONE);
+    // time spent waiting on the server, minus what is copied out meanwhile
+    trace_begin("results");
+    perf_begin("results");
+    if (stream_rows)
+    {
+      /* Copy out each macroblock row as soon as the server says it has
+         landed, while later rows are still being encoded. Only this copy
+         overlaps the encode: write_frame below needs the whole frame, so
+         output still starts after the last row. */
+      int mb_rows = cm->padh[Y_COMPONENT]/16;
+      int rows = 0;
+      int16_t *dst[COLOR_COMPONENTS] = { cm->curframe->residuals->Ydct,
+          cm->curframe->residuals->Udct, cm->curframe->residuals->Vdct };
+      int16_t *src[COLOR_COMPONENTS] = { (int16_t *)result_local_img_seg->Ydct,
+          (int16_t *)result_local_img_seg->Udct, (int16_t *)result_local_img_seg->Vdct };
+
+      while (rows < mb_rows)
+      {
+        int done, c;
+
+        while ((done = local_packets->packet.rows_done) == rows);
+        __sync_synchronize();
+
+        if (rows == 0)
+        {
+          // header is sent before the first row
+          cm->curframe->keyframe = result_local_img_seg->keyframe;
+          memcpy(cm->curframe->mbs[Y_COMPONENT], (const void *)result_local_img_seg->mbs[Y_COMPONENT], cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));
+          memcpy(cm->curframe->mbs[U_COMPONENT], (const void *)result_local_img_seg->mbs[U_COMPONENT], cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+          memcpy(cm->curframe->mbs[V_COMPONENT], (const void *)result_local_img_seg->mbs[V_COMPONENT], cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+        }
+
+        for (c = 0; c < COLOR_COMPONENTS; ++c)
+        {
+          size_t row_size = (c == Y_COMPONENT ? 16 : 8) * cm->padw[c];
+
+          memcpy(dst[c] + rows*row_size, src[c] + rows*row_size,
+              (done - rows) * row_size * sizeof(int16_t));
+        }
+
+        rows = done;
+      }
+
+      while(local_packets->packet.cmd != CMD_DONE);
+    }
+    else
+    {
+      // Waiting for Tegra to finish encoding
+      while(local_packets->packet.cmd != CMD_DONE);
 
 
-    /* Copying memory blocks from local segments which has recived encoding results from Tegra */
-    cm->curframe->keyframe = result_local_img_seg->keyframe;
+      /* Copying memory blocks from local segments which has recived encoding results from Tegra */
+      cm->curframe->keyframe = result_local_img_seg->keyframe;
 
-    // Copying Macroblocks
-    memcpy( cm->curframe->mbs[Y_COMPONENT],result_local_img_seg->mbs[Y_COMPONENT],cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));  //Y
-    memcpy( cm->curframe->mbs[U_COMPONENT],result_local_img_seg->mbs[U_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));  //U
-    memcpy( cm->curframe->mbs[V_COMPONENT],result_local_img_seg->mbs[V_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock)); //V
+      // Copying Macroblocks
+      memcpy( cm->curframe->mbs[Y_COMPONENT],result_local_img_seg->mbs[Y_COMPONENT],cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));  //Y
+      memcpy( cm->curframe->mbs[U_COMPONENT],result_local_img_seg->mbs[U_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));  //U
+      memcpy( cm->curframe->mbs[V_COMPONENT],result_local_img_seg->mbs[V_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock)); //V
 
-    // Copying residuals
-    memcpy( cm->curframe->residuals->Ydct,result_local_img_seg->Ydct,cm->ypw * cm->yph * sizeof(int16_t)); //Ydct
-    memcpy( cm->curframe->residuals->Udct,result_local_img_seg->Udct,cm->upw * cm->uph * sizeof(int16_t));  //Udct
-    memcpy( cm->curframe->residuals->Vdct,result_local_img_seg->Vdct,cm->vpw * cm->vph * sizeof(int16_t));  //Vdct
+      // Copying residuals
+      memcpy( cm->curframe->residuals->Ydct,result_local_img_seg->Ydct,cm->ypw * cm->yph * sizeof(int16_t)); //Ydct
+      memcpy( cm->curframe->residuals->Udct,result_local_img_seg->Udct,cm->upw * cm->uph * sizeof(int16_t));  //Udct
+      memcpy( cm->curframe->residuals->Vdct,result_local_img_seg->Vdct,cm->vpw * cm->vph * sizeof(int16_t));  //Vdct
+    }
+    perf_end("results");
+    trace_end("results");
 
     // write_frame
+    trace_begin("write");
+    perf_begin("write");
     write_frame(cm);
-    printf("Done!\n");
+    perf_end("write");
+    trace_end("write");
+    perf_frame();
+
+    if (latency_target)
+    {
+      // live, hand the frame to the consumer right away
+      fflush(outfile);
+
+      last_latency = (timestamp() - capture)*1000.0;
+      encode_ms = (timestamp() - encode_start)*1000.0;
+      total_latency += last_latency;
+      if (last_latency > max_latency) { max_latency = last_latency; }
+      if (last_latency > latency_target) { ++late; }
+
+      fprintf(msg, "Done! (%.1f ms)\n", last_latency);
+    }
+    else
+    {
+      fprintf(msg, "Done!\n");
+    }
     ++numframes;
     if (limit_numframes && numframes >= limit_numframes) { 
       break; 
@@ -571,7 +1005,24 @@ int main(int argc, char **argv)
     
   /* print time */
   elapsed = (end_time.tv_sec - start_time.tv_sec) +(end_time.tv_nsec - start_time.tv_nsec)/1e9;
-  printf("Completed in %.3fs. s\n",elapsed);
+  fprintf(msg, "Completed in %.3fs. s\n",elapsed);
+
+  if (memory != ALLOC_DEFAULT) { alloc_report(msg, "Encoding"); }
+
+  trace_write();
+  perf_report(msg);
+
+  if (delta_input && full_bytes)
+  {
+    fprintf(msg, "Delta input: sent %.1f%% of the full planes\n",
+        100.0 * sent_bytes / full_bytes);
+  }
+
+  if (latency_target && numframes)
+  {
+    fprintf(msg, "Latency: avg %.1f ms, max %.1f ms, %d of %d frames over %.1f ms, %d dropped\n",
+        total_latency/numframes, max_latency, late, numframes, latency_target, dropped);
+  }
   
   //closing operations
   fclose(outfile);
@@ -3,6 +3,7 @@
 #include <getopt.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,9 +15,88 @@
 #include "c63.h"
 #include "common.h"
 #include "me.h"
+#include "me_luma.h"
+#include "me_range.h"
+#include "affinity.h"
+#include "alloc.h"
+#include "delta.h"
+#include "dma.h"
+#include "encoder.h"
 #include "tables.h"
+#include "tile.h"
+#include "perf.h"
+#include "trace.h"
+#include "transform.h"
+
+static enum alloc_mode memory = ALLOC_DEFAULT;
+static struct affinity affinity;
+static enum chroma_mv chroma_mv = CHROMA_MV_SEARCH;
+static int report_psnr = 0;
+static int range_min = 0, range_max = 0;  //adaptive search range with -R
+
+/* Sessions. Each one is a client stream with its own segments (see
+   GET_SEGMENTID in common.h), c63_common state and thread */
+struct session
+{
+  int id;
+  uint32_t remote_node;
+  pthread_t thread;
+};
+
+static struct session sessions[MAX_SESSIONS];
+static int num_sessions = 1;
+
+/* Frames of all sessions are encoded in the order they arrived, at most
+   encode_slots at a time, so a busy stream can not starve the others */
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned int next_ticket;
+  unsigned int done;
+} sched = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+static int encode_slots = 1;
+
+static void sched_acquire(void)
+{
+  pthread_mutex_lock(&sched.lock);
+  unsigned int ticket = sched.next_ticket++;
+  while (ticket - sched.done >= (unsigned int)encode_slots)
+  {
+    pthread_cond_wait(&sched.cond, &sched.lock);
+  }
+  pthread_mutex_unlock(&sched.lock);
+}
+
+static void sched_release(void)
+{
+  pthread_mutex_lock(&sched.lock);
+  ++sched.done;
+  pthread_cond_broadcast(&sched.cond);
+  pthread_mutex_unlock(&sched.lock);
+}
+
+// The block kernels are global, every session has to ask for the same one
+static void session_transform(int id, enum transform_type type)
+{
+  static int selected = -1;
 
-static uint32_t remote_node = 0;
+  pthread_mutex_lock(&sched.lock);
+  if (selected < 0)
+  {
+    transform_select(type);
+    selected = type;
+    fprintf(stderr, "Using %s DCT\n", transform_name(type));
+  }
+  pthread_mutex_unlock(&sched.lock);
+
+  if (selected != (int)type)
+  {
+    fprintf(stderr, "Session %d wants the %s DCT, but %s is in use by another session\n",
+        id, transform_name(type), transform_name(selected));
+    exit(EXIT_FAILURE);
+  }
+}
 
 /* getopt */
 extern int optind;
@@ -26,111 +106,147 @@ static void print_help()
 {
   printf("Usage: ./c63server -r nodeid\n");
   printf("Commandline options:\n");
-  printf("  -r Node id of client\n");
+  printf("  -r Node id of client, or a comma separated list with one per session\n");
+  printf("  [-n] Number of sessions (client streams) to serve, clients pick one with -S\n");
+  printf("  [-j] Frames encoded at the same time across sessions (default 1)\n");
+  printf("  [-m] Frame memory: none, thp or huge (pages)\n");
+  printf("  [-T] Write a timeline trace to this file\n");
+  printf("  [-M] Chroma motion vectors: search, derive (from luma) or refine (derive, then +-1)\n");
+  printf("  [-R] Adapt the motion search range per frame within min,max, e.g. 4,32\n");
+  printf("  [-q] Print the average PSNR of each session at exit\n");
+  printf("  [-E] Hardware counters per stage: cycles,instructions,l1d,llc,branch,dtlb or all\n");
+  affinity_help();
   printf("\n");
 
   exit(EXIT_FAILURE);
 }
 
-static void c63_encode_image(struct c63_common *cm, yuv_t *image)
+/* Row by row result transfer. Each finished macroblock row is copied to the
+   result segment and sent with its own DMA while the next row is encoded.
+   Once a row has landed, rows_done in the client's control packet is
+   bumped so the client can pick it up. */
+struct row_stream
 {
-  //Advance to next frame 
-  destroy_frame(cm->refframe);
-  cm->refframe = cm->curframe;
-  cm->curframe = create_frame(cm, image);
-
-  //Check if keyframe
-  if (cm->framenum == 0 || cm->frames_since_keyframe == cm->keyframe_interval)
-  {
-    cm->curframe->keyframe = 1;
-    cm->frames_since_keyframe = 0;
-
-    fprintf(stderr, " (keyframe) ");
-  }
-  else { cm->curframe->keyframe = 0; }
+  struct dma_transfer xfer;       //header or row in flight
+  sci_local_segment_t local_segment;
+  sci_remote_segment_t remote_segment;
+  volatile uint8_t *seg;          //mapped local result segment
+  size_t mbs_offset[COLOR_COMPONENTS];
+  size_t dct_offset[COLOR_COMPONENTS];
+  size_t nz_offset[COLOR_COMPONENTS];
+  volatile struct com_packets *remote_packets;
+  int pending;                    //row with DMA in flight, -1 for the header
+};
 
-  if (!cm->curframe->keyframe)
-  {
-    //Motion Estimation
-    c63_motion_estimate(cm);
-  //Motion Compensation 
-    c63_motion_compensate(cm);
-  }
+static void stream_dma(struct row_stream *rs, size_t offset, size_t size)
+{
+  dma_start(&rs->xfer, rs->local_segment, rs->remote_segment, offset, offset,
+      size);
+}
 
-  /* DCT and Quantization */
-  //Y
-  dct_quantize(image->Y, cm->curframe->predicted->Y, cm->padw[Y_COMPONENT],cm->padh[Y_COMPONENT], cm->curframe->residuals->Ydct,cm->quanttbl[Y_COMPONENT]);
-  //U
-  dct_quantize(image->U, cm->curframe->predicted->U, cm->padw[U_COMPONENT],cm->padh[U_COMPONENT], cm->curframe->residuals->Udct,cm->quanttbl[U_COMPONENT]);
-  //V
-  dct_quantize(image->V, cm->curframe->predicted->V, cm->padw[V_COMPONENT],cm->padh[V_COMPONENT], cm->curframe->residuals->Vdct,cm->quanttbl[V_COMPONENT]);
+// Wait for the transfer in flight and tell the client what has landed
+static void stream_publish(struct row_stream *rs)
+{
+  trace_begin("row dma wait");
+  dma_transfer_wait(&rs->xfer);
+  trace_end("row dma wait");
+  dma_transfer_init(rs->xfer.dma, &rs->xfer);
 
-  /* Reconstruct frame for inter-prediction */
-  dequantize_idct(cm->curframe->residuals->Ydct, cm->curframe->predicted->Y,cm->ypw, cm->yph, cm->curframe->recons->Y, cm->quanttbl[Y_COMPONENT]); //Y
-  dequantize_idct(cm->curframe->residuals->Udct, cm->curframe->predicted->U,cm->upw, cm->uph, cm->curframe->recons->U, cm->quanttbl[U_COMPONENT]);  //U
-  dequantize_idct(cm->curframe->residuals->Vdct, cm->curframe->predicted->V,cm->vpw, cm->vph, cm->curframe->recons->V, cm->quanttbl[V_COMPONENT]); //V
+  rs->remote_packets->packet.rows_done = rs->pending + 1;
 }
-//function for freeing memory 
-void free_image_data( yuv_t *image)
+
+/* Keyframe flag and macroblocks are known once motion estimation is done,
+   they go first as a single transfer */
+static void stream_start_frame(struct c63_common *cm, struct row_stream *rs)
 {
-  free(image->Y);
-  free(image->U);
-  free(image->V);
-  free(image);
+  uint8_t *seg = (uint8_t *)rs->seg;
+
+  // keyframe is the first member of result_img_segment
+  *(volatile int *)rs->seg = cm->curframe->keyframe;
+
+  memcpy(seg + rs->mbs_offset[Y_COMPONENT], cm->curframe->mbs[Y_COMPONENT], cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));
+  memcpy(seg + rs->mbs_offset[U_COMPONENT], cm->curframe->mbs[U_COMPONENT], cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+  memcpy(seg + rs->mbs_offset[V_COMPONENT], cm->curframe->mbs[V_COMPONENT], cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+
+  rs->pending = -1;
+  stream_dma(rs, 0, rs->dct_offset[Y_COMPONENT]);
 }
 
-struct c63_common* init_c63_enc(int width, int height)
+static void stream_row(struct c63_common *cm, int mb_row, void *arg)
 {
-  int i;
+  struct row_stream *rs = arg;
+  int16_t *residuals[COLOR_COMPONENTS] = { cm->curframe->residuals->Ydct,
+      cm->curframe->residuals->Udct, cm->curframe->residuals->Vdct };
+  int c;
 
-  /* calloc() sets allocated memory to zero */
-  struct c63_common *cm = calloc(1, sizeof(struct c63_common));
+  if (mb_row == 0) { stream_start_frame(cm, rs); }
 
-  cm->width = width;
-  cm->height = height;
+  // the previous row was sent while this one was encoded
+  stream_publish(rs);
 
-  cm->padw[Y_COMPONENT] = cm->ypw = (uint32_t)(ceil(width/16.0f)*16); //Ypw
-  cm->padh[Y_COMPONENT] = cm->yph = (uint32_t)(ceil(height/16.0f)*16); //Yph
-  cm->padw[U_COMPONENT] = cm->upw = (uint32_t)(ceil(width*UX/(YX*8.0f))*8); //Upw
-  cm->padh[U_COMPONENT] = cm->uph = (uint32_t)(ceil(height*UY/(YY*8.0f))*8); //Uph
-  cm->padw[V_COMPONENT] = cm->vpw = (uint32_t)(ceil(width*VX/(YX*8.0f))*8);  //Vpw
-  cm->padh[V_COMPONENT] = cm->vph = (uint32_t)(ceil(height*VY/(YY*8.0f))*8);  //Vph
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    // 16 luma rows or 8 chroma rows, all blocks of a row are contiguous
+    size_t rows = c == Y_COMPONENT ? 16 : 8;
+    size_t start = mb_row * rows * cm->padw[c];
+    size_t offset = rs->dct_offset[c] + start * sizeof(int16_t);
 
-  cm->mb_cols = cm->ypw / 8;
-  cm->mb_rows = cm->yph / 8;
+    memcpy((uint8_t *)rs->seg + offset, residuals[c] + start,
+        rows * cm->padw[c] * sizeof(int16_t));
+    stream_dma(rs, offset, rows * cm->padw[c] * sizeof(int16_t));
 
-  /* Quality parameters -- Home exam deliveries should have original values,
-   i.e., quantization factor should be 25, search range should be 16, and the
-   keyframe interval should be 100. */
-  cm->qp = 25;                  // Constant quantization factor. Range: [1..50]
-  cm->me_search_range = 16;     // Pixels in every direction
-  cm->keyframe_interval = 100;  // Distance between keyframes
+    // the transform wrote the block info in place, a row of it fits PIO
+    stream_dma(rs, rs->nz_offset[c] + start/64, rows * cm->padw[c] / 64);
+  }
 
-  //quantization tables
-  for (i = 0; i < 64; ++i)
+  rs->pending = mb_row;
+}
+
+/* PSNR of the visible part of a reconstructed plane, capped at 100 dB for
+   a lossless one */
+static double plane_psnr(const uint8_t *orig, const uint8_t *recons,
+    int stride, int width, int height)
+{
+  uint64_t sse = 0;
+  int x, y;
+
+  for (y = 0; y < height; ++y)
   {
-    cm->quanttbl[Y_COMPONENT][i] = yquanttbl_def[i] / (cm->qp / 10.0);
-    cm->quanttbl[U_COMPONENT][i] = uvquanttbl_def[i] / (cm->qp / 10.0);
-    cm->quanttbl[V_COMPONENT][i] = uvquanttbl_def[i] / (cm->qp / 10.0);
+    for (x = 0; x < width; ++x)
+    {
+      int d = orig[y*stride+x] - recons[y*stride+x];
+      sse += d*d;
+    }
   }
 
-  return cm;
+  if (!sse) { return 100.0; }
+
+  return 10.0 * log10(255.0*255.0 * width*height / sse);
 }
 
-int main(int argc, char **argv)
+//function for freeing memory 
+void free_image_data( yuv_t *image)
+{
+  c63_free(image->Y);
+  c63_free(image->U);
+  c63_free(image->V);
+  free(image);
+}
+
+static void *session_run(void *arg)
 {
+  struct session *session = arg;
   int c;
   
   //SISCI declarations
   sci_desc_t v_dev;  
   sci_error_t error;
+  uint32_t remote_node = session->remote_node;
   unsigned int local_adapter_num= 0;
   size_t localOffset = 0;
   size_t remoteOffset = 0;
-  /* DMA queue for image */
-  sci_dma_queue_t	dmaq;         
-  /* maximum entries inside dmaq */  
-  unsigned int max_entries = 1; 
+  /* DMA queues for results */
+  struct dma dma;
 
   /* segments for the y, u, v transfer from x86 */
   sci_remote_segment_t remote_segment;
@@ -152,31 +268,30 @@ int main(int argc, char **argv)
   sci_remote_segment_t result_remote_segment;
   sci_map_t result_local_map;
   
-  if (argc == 1) { print_help(); }
+  /* file descriptor */
+  SCIOpen(&v_dev,NO_FLAGS,&error);
+  if (error != SCI_ERR_OK) {
+     fprintf(stderr, "SCIOpen failed: %s (0x%x)\n",
+             SCIGetErrorString(error), error);
+     exit(error);
+  }
 
-  while ((c = getopt(argc, argv, "h:w:o:f:i:r:")) != -1) //extracting options
+  /* Session threads go on the worker cpus, one each, and take the control
+     thread's priority there; main checked that no two of them share a cpu
+     when -p is given */
+  if (num_sessions > 1 && affinity.num_workers)
   {
-    switch (c)
-    {
-      case 'r':
-        remote_node = atoi(optarg);
-        break;
-      default:
-        print_help(); //help in commands
-        break;
-    }
+    affinity_pin_nth(affinity.workers, affinity.num_workers, session->id);
+    affinity_apply_priority(&affinity);
   }
 
-  /* Initialize the SISCI library */
-  SCIInitialize(0, &error);
-  if (error != SCI_ERR_OK) {
-      fprintf(stderr,"SCIInitialize failed: %s\n", SCIGetErrorString(error));
-      exit(EXIT_FAILURE);
-  }
+  // counters follow one thread, like the fault counts session 0 gets them
+  if (session->id == 0) { perf_open(); }
+
   //create segment for PIO
   SCICreateSegment(v_dev,
                    &local_segment_com,
-                   SEGMENT_REMOTE_COM,
+                   SEGMENT_REMOTE_COM(session->id),
                    sizeof(struct com_packets),
                    NO_CALLBACK,
                    NULL,
@@ -207,7 +322,7 @@ int main(int argc, char **argv)
        SCIConnectSegment(v_dev,
                          &remote_segment_com,
                          remote_node,
-                         SEGMENT_LOCAL_COM,
+                         SEGMENT_LOCAL_COM(session->id),
                          local_adapter_num,
                          NO_CALLBACK,
                          NULL,
@@ -247,6 +362,14 @@ int main(int argc, char **argv)
 
    // Creating cm struct with image width and image height from x86
    struct c63_common *cm = init_c63_enc(remote_packets->packet.img_width,remote_packets->packet.img_height);
+   enum layout layout = remote_packets->packet.layout;
+   int stream = remote_packets->packet.stream;
+   session_transform(session->id, remote_packets->packet.transform);
+   if (num_sessions > 1)
+   {
+     fprintf(stderr, "Session %d: %dx%d from node %u\n", session->id, cm->width,
+         cm->height, remote_node);
+   }
 
   //image segment for transfering image data to tegra through DMA
   volatile struct img_segment
@@ -271,17 +394,28 @@ int main(int argc, char **argv)
     int16_t *Udct[cm->upw * cm->uph];
     //Vdct
     int16_t *Vdct[cm->vpw * cm->vph];
+    // coded flag and last coefficient of each block, see transform.h
+    uint8_t nz[COLOR_COMPONENTS][cm->mb_rows * cm->mb_cols];
   } *result_local_img_seg;
 
 
+  // with huge pages the segments are backed by our own pinned memory
+  void *img_mem = NULL;
+  void *result_mem = NULL;
+  if (memory != ALLOC_DEFAULT)
+  {
+    img_mem = c63_alloc(sizeof(struct img_segment));
+    result_mem = c63_alloc(sizeof(struct result_img_segment));
+  }
+
   //create segment 
   SCICreateSegment(v_dev,
                    &local_segment,
-                   SEGMENT_REMOTE,
+                   SEGMENT_REMOTE(session->id),
                    sizeof(struct img_segment),
                    NO_CALLBACK,
                    NULL,
-                   NO_FLAGS,
+                   img_mem ? SCI_FLAG_EMPTY : NO_FLAGS,
                    &error);
   if(error != SCI_ERR_OK){
    fprintf(stderr, "SCICreateSegment failed: %s - Error code: (0x%x)\n",
@@ -289,6 +423,16 @@ int main(int argc, char **argv)
    exit(EXIT_FAILURE);
   }
 
+  if (img_mem)
+  {
+    SCIRegisterSegmentMemory(img_mem, sizeof(struct img_segment), local_segment, NO_FLAGS, &error);
+    if(error != SCI_ERR_OK){
+     fprintf(stderr, "SCIRegisterSegmentMemory failed: %s - Error code: (0x%x)\n",
+             SCIGetErrorString(error), error);
+     exit(EXIT_FAILURE);
+    }
+  }
+
   //prepare segment
   SCIPrepareSegment(local_segment, local_adapter_num, NO_FLAGS, &error);
   if(error != SCI_ERR_OK){
@@ -308,17 +452,27 @@ int main(int argc, char **argv)
   //Create segment for image results
   SCICreateSegment(v_dev,
                   &result_local_segment,
-                  SEGMENT_REMOTE_RESULT,
+                  SEGMENT_REMOTE_RESULT(session->id),
                   sizeof(struct result_img_segment),
                   NO_CALLBACK,
                   NULL,
-                  NO_FLAGS,
+                  result_mem ? SCI_FLAG_EMPTY : NO_FLAGS,
                   &error);
   if(error != SCI_ERR_OK){
     fprintf(stderr, "SCICreateSegment failed: %s - Error code: (0x%x)\n",
             SCIGetErrorString(error), error);
     exit(EXIT_FAILURE);
   }
+
+  if (result_mem)
+  {
+    SCIRegisterSegmentMemory(result_mem, sizeof(struct result_img_segment), result_local_segment, NO_FLAGS, &error);
+    if(error != SCI_ERR_OK){
+      fprintf(stderr, "SCIRegisterSegmentMemory failed: %s - Error code: (0x%x)\n",
+              SCIGetErrorString(error), error);
+      exit(EXIT_FAILURE);
+    }
+  }
   //prepare
   SCIPrepareSegment(result_local_segment, local_adapter_num, NO_FLAGS, &error);
   if(error != SCI_ERR_OK){
@@ -354,7 +508,7 @@ int main(int argc, char **argv)
       SCIConnectSegment(v_dev,
                         &result_remote_segment,
                         remote_node,
-                        SEGMENT_LOCAL_RESULT,
+                        SEGMENT_LOCAL_RESULT(session->id),
                         local_adapter_num,
                         NO_CALLBACK,
                         NULL,
@@ -372,102 +526,237 @@ int main(int argc, char **argv)
                                         &error);
 
 
-  //DMA queue for transfering encoded image results
-  
-  SCICreateDMAQueue(v_dev,
-                    &dmaq,
-                    local_adapter_num,
-                    max_entries,
-                    NO_FLAGS,
-                    &error
-                  );
-  if(error != SCI_ERR_OK){
-    fprintf(stderr, "SCICreateDMAQueue failed: %s - Error code: (0x%x)\n",
-            SCIGetErrorString(error), error);
-    exit(EXIT_FAILURE);
+  //DMA queues for transfering encoded image results, same tuning as the client
+  while (!remote_packets->packet.dma_ready);
+  dma_init(&dma, v_dev, local_adapter_num, remote_packets->packet.dma_queues,
+      remote_packets->packet.dma_chunk);
+
+  // macroblocks and streamed rows are often small enough for PIO
+  dma_map_pio(&dma, result_local_segment, (void *)result_local_img_seg,
+      result_remote_segment, sizeof(struct result_img_segment));
+  if (remote_packets->packet.pio_threshold >= 0)
+  {
+    dma.pio_threshold = remote_packets->packet.pio_threshold;
+  }
+  else
+  {
+    dma.pio_threshold = dma_calibrate(&dma, result_local_segment,
+        cm->ypw * cm->yph * sizeof(int16_t));
   }
+  fprintf(stderr, "PIO below %zu bytes\n", dma.pio_threshold);
+
+  // calibration is done, the client may send pings and frames now
+  remote_packets->packet.server_ready = 1;
 
   // Creating image variables to use while encoding
   yuv_t *image;
   image = malloc(sizeof(*image));
   //Y
-  image->Y = calloc(1, cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
+  image->Y = c63_alloc(cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
   //U
-  image->U = calloc(1, cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
+  image->U = c63_alloc(cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
   //V
-  image->V = calloc(1, cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
+  image->V = c63_alloc(cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
+
+  // fault and TLB counters are per process, session 0 reports them
+  if (memory != ALLOC_DEFAULT && session->id == 0) { alloc_report(stderr, "Setup"); }
+
+  /* Planes as they sit in the segment. With tiled input the transform reads
+     blocks straight from there, the raster copy is only rebuilt for motion
+     estimation on inter frames */
+  yuv_t tiled;
+  tiled.Y = (uint8_t *)local_img_seg->Y;
+  tiled.U = (uint8_t *)local_img_seg->U;
+  tiled.V = (uint8_t *)local_img_seg->V;
+
+  // block info goes straight into the result segment
+  uint8_t *nz[COLOR_COMPONENTS];
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    nz[c] = (uint8_t *)result_local_img_seg->nz[c];
+  }
+
+  struct row_stream rs;
+  dma_transfer_init(&dma, &rs.xfer);
+  rs.local_segment = result_local_segment;
+  rs.remote_segment = result_remote_segment;
+  rs.seg = (volatile uint8_t *)result_local_img_seg;
+  rs.mbs_offset[Y_COMPONENT] = (uint8_t *)result_local_img_seg->mbs[Y_COMPONENT] - (uint8_t *)result_local_img_seg;
+  rs.mbs_offset[U_COMPONENT] = (uint8_t *)result_local_img_seg->mbs[U_COMPONENT] - (uint8_t *)result_local_img_seg;
+  rs.mbs_offset[V_COMPONENT] = (uint8_t *)result_local_img_seg->mbs[V_COMPONENT] - (uint8_t *)result_local_img_seg;
+  rs.dct_offset[Y_COMPONENT] = (uint8_t *)result_local_img_seg->Ydct - (uint8_t *)result_local_img_seg;
+  rs.dct_offset[U_COMPONENT] = (uint8_t *)result_local_img_seg->Udct - (uint8_t *)result_local_img_seg;
+  rs.dct_offset[V_COMPONENT] = (uint8_t *)result_local_img_seg->Vdct - (uint8_t *)result_local_img_seg;
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    rs.nz_offset[c] = (uint8_t *)result_local_img_seg->nz[c] - (uint8_t *)result_local_img_seg;
+  }
+  rs.remote_packets = remote_packets;
+  row_done_t row_done = stream ? stream_row : NULL;
+
+  // summed per frame for -q
+  double psnr[COLOR_COMPONENTS] = { 0.0, 0.0, 0.0 };
+
+  struct me_range range;
+  if (range_max) { me_range_init(&range, range_min, range_max, cm->me_search_range); }
 
   //encoding loop
   while(1)
   {
     // wait for x86 to read and transfer image data packets to Tegra
+    trace_begin("wait");
     while(local_packets->packet.cmd == CMD_INVALID);
+    trace_end("wait");
 
     // Exit when x86 sends CMD_QUIT
     if(local_packets->packet.cmd == CMD_QUIT){
       break;
     }
+
+    // clock sync before the first frame of a traced run
+    if(local_packets->packet.cmd == CMD_PING){
+      trace_sync_answer(local_packets, remote_packets);
+      continue;
+    }
     
     // set CMD_INVALID to tell x86 to wait
     local_packets->packet.cmd = CMD_INVALID;
 
-   //Copying memory blocks from client segment image
-   //Y
-    memcpy( image->Y,local_img_seg->Y,cm->padw[Y_COMPONENT]*cm->padh[Y_COMPONENT]);
-    //U
-    memcpy( image->U,local_img_seg->U,cm->padw[U_COMPONENT]*cm->padh[U_COMPONENT]);
-    //V
-    memcpy( image->V,local_img_seg->V,cm->padw[V_COMPONENT]*cm->padh[V_COMPONENT]);
-
-    // Encode frame
-    c63_encode_image(cm, image);
-
-    //Copying encoded result images to local result-segment
-    result_local_img_seg->keyframe = cm->curframe->keyframe;
-
-    //Copying macroblocks
-    //Y
-    memcpy( result_local_img_seg->mbs[Y_COMPONENT],cm->curframe->mbs[Y_COMPONENT],cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));
-    //U
-    memcpy( result_local_img_seg->mbs[U_COMPONENT],cm->curframe->mbs[U_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
-    //V
-    memcpy( result_local_img_seg->mbs[V_COMPONENT],cm->curframe->mbs[V_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
-
-    //Copying residuals
-    //Ydct
-    memcpy(result_local_img_seg->Ydct,cm->curframe->residuals->Ydct, cm->ypw * cm->yph * sizeof(int16_t));
-    //Udct
-    memcpy(result_local_img_seg->Udct,cm->curframe->residuals->Udct, cm->upw * cm->uph * sizeof(int16_t));
-    //Vdct
-    memcpy(result_local_img_seg->Vdct,cm->curframe->residuals->Vdct, cm->vpw * cm->vph * sizeof(int16_t));
+    // the client dropped frames, next one restarts prediction
+    if (remote_packets->packet.force_keyframe)
+    {
+      cm->frames_since_keyframe = cm->keyframe_interval;
+    }
 
+    /* Planes land one at a time, each one is copied out of the segment
+       while the next is still in flight. With chroma vectors derived from
+       luma, motion estimation only needs Y and runs as soon as it is in,
+       while U and V are still on their way. */
+    uint8_t *planes[COLOR_COMPONENTS] = { image->Y, image->U, image->V };
+    uint8_t *seg_planes[COLOR_COMPONENTS] = { tiled.Y, tiled.U, tiled.V };
+    int inter = cm->framenum != 0 && cm->frames_since_keyframe != cm->keyframe_interval;
+    int luma_first = inter && chroma_mv != CHROMA_MV_SEARCH;
 
-    //Startng transfer of encoded image results from local result segment to remote result segment through DMA
-    SCIStartDmaTransfer(dmaq,
-                        result_local_segment,
-                        result_remote_segment,
-                        localOffset,
-                        sizeof(struct result_img_segment),
-                        remoteOffset,
-                        NO_CALLBACK,
-                        NULL,
-                        NO_FLAGS,
-                        &error);
-    if(error != SCI_ERR_OK){
-      fprintf(stderr,"SCIStartDmaTransfer failed: %s - Error code: (0x%x)\n",
-              SCIGetErrorString(error), error);
-      exit(EXIT_FAILURE);
+    if (range_max) { cm->me_search_range = range.range; }
+
+    trace_begin("planes");
+    perf_begin("planes");
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      if (c == U_COMPONENT && luma_first)
+      {
+        perf_end("planes");
+        trace_end("planes");
+
+        /* luma search takes a slot of its own, the one for the rest of
+           the frame is only asked for once U and V are in, so no slot is
+           held while waiting for the transfer */
+        sched_acquire();
+        c63_start_frame(cm, image);
+
+        trace_begin("me");
+        perf_begin("me");
+        me_estimate_luma(cm);
+        perf_end("me");
+        trace_end("me");
+        sched_release();
+
+        trace_begin("planes");
+        perf_begin("planes");
+      }
+
+      while (!(local_packets->packet.planes_ready & (1 << c)));
+
+      if (layout == LAYOUT_TILED)
+      {
+        // keyframes skip motion estimation and only need the raster copy for -q
+        if (inter || report_psnr) { untile_plane(planes[c], seg_planes[c], cm->padw[c], cm->padh[c]); }
+      }
+      else if (local_packets->packet.planes_delta & (1 << c))
+      {
+        // image still holds the previous frame, patch in the changed blocks
+        delta_apply(planes[c], seg_planes[c], cm->padw[c], cm->padh[c]);
+      }
+      else
+      {
+        memcpy(planes[c], seg_planes[c], cm->padw[c]*cm->padh[c]);
+      }
     }
 
-    // Waiting for DMA to finish
-    SCIWaitForDMAQueue(dmaq,
-                      SCI_INFINITE_TIMEOUT,
-                      NO_FLAGS,
-                      &error);
-    if(error != SCI_ERR_OK){
-      fprintf(stderr,"SCIWaitForDMAQueue failed: %s - Error code: (0x%x)\n",
-              SCIGetErrorString(error), error);
-      exit(EXIT_FAILURE);
+    perf_end("planes");
+    trace_end("planes");
+
+    // Encode frame, in turn with the other sessions
+    sched_acquire();
+    if (!luma_first) { c63_start_frame(cm, image); }
+    trace_begin("encode");
+    c63_encode_frame(cm, layout == LAYOUT_TILED ? &tiled : NULL, chroma_mv,
+        luma_first, nz, row_done, &rs);
+    if (cm->curframe->keyframe) { fprintf(stderr, " (keyframe) "); }
+    trace_end("encode");
+
+    perf_begin("result");
+    if (stream)
+    {
+      // last row is still in flight
+      stream_publish(&rs);
+    }
+    else
+    {
+      //Copying encoded result images to local result-segment
+      result_local_img_seg->keyframe = cm->curframe->keyframe;
+
+      //Copying macroblocks
+      //Y
+      memcpy( result_local_img_seg->mbs[Y_COMPONENT],cm->curframe->mbs[Y_COMPONENT],cm->mb_rows * cm->mb_cols * sizeof(struct macroblock));
+      //U
+      memcpy( result_local_img_seg->mbs[U_COMPONENT],cm->curframe->mbs[U_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+      //V
+      memcpy( result_local_img_seg->mbs[V_COMPONENT],cm->curframe->mbs[V_COMPONENT],cm->mb_rows/2 * cm->mb_cols/2 * sizeof(struct macroblock));
+
+      //Copying residuals
+      //Ydct
+      memcpy(result_local_img_seg->Ydct,cm->curframe->residuals->Ydct, cm->ypw * cm->yph * sizeof(int16_t));
+      //Udct
+      memcpy(result_local_img_seg->Udct,cm->curframe->residuals->Udct, cm->upw * cm->uph * sizeof(int16_t));
+      //Vdct
+      memcpy(result_local_img_seg->Vdct,cm->curframe->residuals->Vdct, cm->vpw * cm->vph * sizeof(int16_t));
+
+
+      //Startng transfer of encoded image results from local result segment to remote result segment through DMA
+      trace_begin("result dma");
+      struct dma_transfer xfer;
+      dma_transfer_init(&dma, &xfer);
+      dma_start(&xfer, result_local_segment, result_remote_segment, localOffset,
+          remoteOffset, sizeof(struct result_img_segment));
+
+      // Waiting for DMA to finish
+      dma_transfer_wait(&xfer);
+      trace_end("result dma");
+    }
+    perf_end("result");
+
+    sched_release();
+    perf_frame();
+
+    if (range_max && !cm->curframe->keyframe)
+    {
+      me_range_update(&range, cm);
+      fprintf(stderr, "Session %d frame %d: search range %d, 95%% of vectors within %d, %.1f%% at the edge, next %d\n",
+          session->id, cm->framenum, cm->me_search_range, range.percentile,
+          range.edge_percent, range.range);
+    }
+
+    if (report_psnr)
+    {
+      yuv_t *recons = cm->curframe->recons;
+
+      psnr[Y_COMPONENT] += plane_psnr(image->Y, recons->Y, cm->padw[Y_COMPONENT],
+          cm->width, cm->height);
+      psnr[U_COMPONENT] += plane_psnr(image->U, recons->U, cm->padw[U_COMPONENT],
+          cm->width*UX/YX, cm->height*UY/YY);
+      psnr[V_COMPONENT] += plane_psnr(image->V, recons->V, cm->padw[V_COMPONENT],
+          cm->width*VX/YX, cm->height*VY/YY);
     }
 
     // frame increments from old encode function
@@ -478,12 +767,153 @@ int main(int argc, char **argv)
     remote_packets->packet.cmd = CMD_DONE;
   }
 
+  if (memory != ALLOC_DEFAULT && session->id == 0) { alloc_report(stderr, "Encoding"); }
+  if (session->id == 0) { perf_report(stderr); }
+
+  if (report_psnr && cm->framenum)
+  {
+    fprintf(stderr, "Session %d: PSNR Y %.2f U %.2f V %.2f dB over %d frames, chroma vectors %s\n",
+        session->id, psnr[Y_COMPONENT] / cm->framenum, psnr[U_COMPONENT] / cm->framenum,
+        psnr[V_COMPONENT] / cm->framenum, cm->framenum, chroma_mv_name(chroma_mv));
+  }
+
+  // events go onto the clock of the first client, which sent the offset
+  if (session->id == 0) { trace_set_offset(-local_packets->packet.clock_offset); }
+
   //freeing memory
   free_image_data(image);
 
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int c, i;
+  int num_nodes = 0;
+  uint32_t nodes[MAX_SESSIONS];
+  pthread_attr_t attr;
+  struct sched_param param;
+  sci_error_t error;
+
+  if (argc == 1) { print_help(); }
+
+  while ((c = getopt(argc, argv, "h:w:o:f:i:r:m:c:W:I:p:T:E:M:qR:n:j:")) != -1) //extracting options
+  {
+    switch (c)
+    {
+      case 'r':
+        for (char *p = optarg; *p && num_nodes < MAX_SESSIONS; ++p)
+        {
+          nodes[num_nodes++] = strtoul(p, &p, 10);
+          if (*p != ',') { break; }
+        }
+        break;
+      case 'm':
+        memory = alloc_parse_mode(optarg);
+        break;
+      case 'T':
+        trace_init(optarg, "c63server (tegra)", 2);
+        break;
+      case 'E':
+        perf_init(optarg);
+        break;
+      case 'M':
+        chroma_mv = chroma_mv_parse(optarg);
+        break;
+      case 'q':
+        report_psnr = 1;
+        break;
+      case 'R':
+        if (!me_range_parse(optarg, &range_min, &range_max))
+        {
+          fprintf(stderr, "-R takes min,max between 1 and %d\n", ME_RANGE_LIMIT);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'n':
+        num_sessions = atoi(optarg);
+        break;
+      case 'j':
+        encode_slots = atoi(optarg);
+        break;
+      default:
+        if (affinity_option(&affinity, c, optarg)) { break; }
+        print_help(); //help in commands
+        break;
+    }
+  }
+
+  if (!num_nodes || num_sessions < 1 || num_sessions > MAX_SESSIONS || encode_slots < 1)
+  {
+    print_help();
+  }
+
+  /* Every session thread spins on its control segment, two of them on one
+     cpu at SCHED_FIFO never let each other run */
+  if (num_sessions > 1 && affinity.rt_priority && affinity.num_workers < num_sessions)
+  {
+    fprintf(stderr, "-p with -n %d needs a -W cpu for each session\n", num_sessions);
+    exit(EXIT_FAILURE);
+  }
+
+  affinity_log_config(stderr, &affinity);
+  fprintf(stderr, "Chroma motion vectors %s\n", chroma_mv_name(chroma_mv));
+
+  alloc_init(memory);
+
+  /* Initialize the SISCI library */
+  SCIInitialize(0, &error);
+  if (error != SCI_ERR_OK) {
+      fprintf(stderr,"SCIInitialize failed: %s\n", SCIGetErrorString(error));
+      exit(EXIT_FAILURE);
+  }
+
+  // sessions without a node of their own use the last one given
+  for (i = 0; i < num_sessions; ++i)
+  {
+    sessions[i].id = i;
+    sessions[i].remote_node = nodes[i < num_nodes ? i : num_nodes - 1];
+  }
+
+  if (num_sessions == 1)
+  {
+    // the main thread spins on the control segment, encodes and drives the DMA
+    affinity_apply_control(&affinity);
+    affinity_log(stderr, "Control");
+
+    session_run(&sessions[0]);
+  }
+  else
+  {
+    /* main only waits here, so it is left unpinned at SCHED_OTHER and the
+       session threads get neither the -c cpus nor SCHED_FIFO from it;
+       session_run places them */
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    memset(&param, 0, sizeof(param));
+    pthread_attr_setschedparam(&attr, &param);
+
+    for (i = 0; i < num_sessions; ++i)
+    {
+      if (pthread_create(&sessions[i].thread, &attr, session_run, &sessions[i]))
+      {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+      }
+    }
+    pthread_attr_destroy(&attr);
+
+    for (i = 0; i < num_sessions; ++i)
+    {
+      pthread_join(sessions[i].thread, NULL);
+    }
+  }
+
+  trace_write();
+
   //terminate SISCI 
   SCITerminate();
 
-
+  return 0;
 }
-
@@ -9,22 +9,27 @@
 #ifndef GROUP
 #error Fill in group number in common.h!
 #endif
-#define GET_SEGMENTID(id) ( GROUP << 16 | id )
+/* Every session (one client stream) has its own set of segment IDs, so
+   several streams can share a node. Session 0 has the original IDs. */
+#define GET_SEGMENTID(session, id) ( GROUP << 16 | (session) << 8 | id )
+
+/* Streams one c63server serves, session numbers are 0..MAX_SESSIONS-1 */
+#define MAX_SESSIONS 16
 
 #define NO_CALLBACK NULL
 #define NO_FLAGS 0
 
 /* Segment IDs for transfer */
-#define SEGMENT_LOCAL GET_SEGMENTID(1)
-#define SEGMENT_REMOTE GET_SEGMENTID(2)
+#define SEGMENT_LOCAL(session) GET_SEGMENTID(session, 1)
+#define SEGMENT_REMOTE(session) GET_SEGMENTID(session, 2)
 
 /* Segment IDs for PIO */ 
-#define SEGMENT_LOCAL_COM GET_SEGMENTID(3)
-#define SEGMENT_REMOTE_COM GET_SEGMENTID(4)
+#define SEGMENT_LOCAL_COM(session) GET_SEGMENTID(session, 3)
+#define SEGMENT_REMOTE_COM(session) GET_SEGMENTID(session, 4)
 
 // Segment for encoded results
-#define SEGMENT_LOCAL_RESULT GET_SEGMENTID(5)
-#define SEGMENT_REMOTE_RESULT GET_SEGMENTID(6)
+#define SEGMENT_LOCAL_RESULT(session) GET_SEGMENTID(session, 5)
+#define SEGMENT_REMOTE_RESULT(session) GET_SEGMENTID(session, 6)
 
 
 // Commands for communication
@@ -32,7 +37,8 @@ enum cmd
 {
     CMD_INVALID,    //used to tell to wait
     CMD_QUIT,       //used to tell to stop waiting 
-    CMD_DONE        //used to exit from operation
+    CMD_DONE,       //used to exit from operation
+    CMD_PING        //clock sync ping, see trace.h
 };
 
 //data packet with image params
@@ -43,6 +49,21 @@ struct packet
       uint8_t cmd;
       int img_width;
       int img_height;
+      uint8_t layout;   //enum layout in tile.h
+      uint8_t transform; //enum transform_type in transform.h
+      uint8_t stream;   //send results by macroblock row
+      int rows_done;    //macroblock rows of the current frame in the result segment
+      uint8_t force_keyframe; //set by the client after dropping input frames
+      uint8_t planes_ready; //bit per color component that has landed
+      uint8_t planes_delta; //bit per color component sent as changed blocks, see delta.h
+      uint8_t dma_queues;   //DMA tuning, see dma.h
+      uint8_t dma_ready;    //dma_* and pio_threshold are final, after autotuning
+      uint8_t server_ready; //set by the server once its result transfers are set up
+      uint32_t dma_chunk;
+      int32_t pio_threshold; //bytes, below this transfers use PIO, -1 calibrates
+      uint32_t ping;        //clock sync sequence number, see trace.h
+      int64_t pong_time;    //server clock when the ping was answered, ns
+      int64_t clock_offset; //server minus client clock, ns
     };
   };
 };
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "delta.h"
+
+size_t delta_bitmap_size(uint32_t width, uint32_t height)
+{
+  size_t blocks = (width/TILE_SIZE) * (height/TILE_SIZE);
+
+  return ((blocks+7)/8 + DELTA_ALIGN-1) / DELTA_ALIGN * DELTA_ALIGN;
+}
+
+static int block_equal(const uint8_t *a, const uint8_t *b, uint32_t width)
+{
+  int i;
+
+  for (i = 0; i < TILE_SIZE; ++i)
+  {
+    if (memcmp(a + i*width, b + i*width, TILE_SIZE)) { return 0; }
+  }
+
+  return 1;
+}
+
+size_t delta_pack(uint8_t *out_data, uint8_t *prev, const uint8_t *cur,
+    uint32_t width, uint32_t height)
+{
+  uint8_t *bitmap = out_data;
+  size_t size = delta_bitmap_size(width, height);
+  size_t limit = (size_t)width * height;
+  uint32_t x, y;
+  int n = 0;
+  int i;
+
+  memset(bitmap, 0, size);
+
+  for (y = 0; y < height; y += TILE_SIZE)
+  {
+    for (x = 0; x < width; x += TILE_SIZE, ++n)
+    {
+      size_t offset = y*width + x;
+
+      if (block_equal(prev + offset, cur + offset, width)) { continue; }
+
+      // the full plane is cheaper
+      if (size + TILE_PIXELS >= limit) { return 0; }
+
+      bitmap[n/8] |= 1 << (n%8);
+
+      for (i = 0; i < TILE_SIZE; ++i)
+      {
+        memcpy(out_data + size + i*TILE_SIZE, cur + offset + i*width, TILE_SIZE);
+        memcpy(prev + offset + i*width, cur + offset + i*width, TILE_SIZE);
+      }
+      size += TILE_PIXELS;
+    }
+  }
+
+  return size;
+}
+
+void delta_apply(uint8_t *plane, const uint8_t *in_data, uint32_t width,
+    uint32_t height)
+{
+  const uint8_t *bitmap = in_data;
+  const uint8_t *block = in_data + delta_bitmap_size(width, height);
+  uint32_t x, y;
+  int n = 0;
+  int i;
+
+  for (y = 0; y < height; y += TILE_SIZE)
+  {
+    for (x = 0; x < width; x += TILE_SIZE, ++n)
+    {
+      if (!(bitmap[n/8] & (1 << (n%8)))) { continue; }
+
+      for (i = 0; i < TILE_SIZE; ++i)
+      {
+        memcpy(plane + (y+i)*width + x, block + i*TILE_SIZE, TILE_SIZE);
+      }
+      block += TILE_PIXELS;
+    }
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef C63_DELTA_H_
+#define C63_DELTA_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile.h"
+
+/* Delta input. A plane is sent as the 8x8 blocks that differ from the
+   previous frame: a bitmap with one bit per block in raster block order,
+   padded to DELTA_ALIGN bytes, followed by the changed blocks in the same
+   order, 64 bytes each in tiled layout. */
+#define DELTA_ALIGN 64
+
+size_t delta_bitmap_size(uint32_t width, uint32_t height);
+
+/* Pack the blocks of cur that differ from prev into out and copy them to
+   prev. Returns the packed size, or 0 if it would not be smaller than the
+   plane, in which case prev is left partly updated and the caller sends
+   and keeps the full plane. */
+size_t delta_pack(uint8_t *out_data, uint8_t *prev, const uint8_t *cur,
+    uint32_t width, uint32_t height);
+
+/* Patch a packed delta into a raster plane holding the previous frame */
+void delta_apply(uint8_t *plane, const uint8_t *in_data, uint32_t width,
+    uint32_t height);
+
+#endif  /* C63_DELTA_H_ */
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sisci_error.h>
+#include <sisci_api.h>
+
+#include "common.h"
+#include "dma.h"
+
+void dma_init(struct dma *dma, sci_desc_t sd, unsigned int adapter,
+    int num_queues, size_t chunk_size)
+{
+  sci_error_t error;
+  int i;
+
+  if (num_queues < 1) { num_queues = 1; }
+  if (num_queues > DMA_MAX_QUEUES) { num_queues = DMA_MAX_QUEUES; }
+
+  dma->num_queues = num_queues;
+  dma->chunk_size = chunk_size;
+  dma->next = 0;
+  dma->pio_threshold = 0;
+  dma->pio_dst = NULL;
+
+  for (i = 0; i < num_queues; ++i)
+  {
+    dma->outstanding[i] = 0;
+
+    SCICreateDMAQueue(sd,
+                      &dma->queues[i],
+                      adapter,
+                      DMA_QUEUE_ENTRIES,
+                      NO_FLAGS,
+                      &error);
+    if(error != SCI_ERR_OK){
+      fprintf(stderr, "SCICreateDMAQueue failed: %s - Error code: (0x%x)\n",
+              SCIGetErrorString(error), error);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void dma_free(struct dma *dma)
+{
+  sci_error_t error;
+  int i;
+
+  for (i = 0; i < dma->num_queues; ++i)
+  {
+    while (dma->outstanding[i]);
+    SCIRemoveDMAQueue(dma->queues[i], NO_FLAGS, &error);
+  }
+
+  if (dma->pio_dst) { SCIUnmapSegment(dma->pio_map, NO_FLAGS, &error); }
+}
+
+void dma_map_pio(struct dma *dma, sci_local_segment_t local_segment,
+    const void *local, sci_remote_segment_t remote, size_t size)
+{
+  sci_error_t error;
+
+  dma->pio_dst = SCIMapRemoteSegment(remote,
+                                     &dma->pio_map,
+                                     0,
+                                     size,
+                                     NULL,
+                                     NO_FLAGS,
+                                     &error);
+  if(error != SCI_ERR_OK){
+    fprintf(stderr, "SCIMapRemoteSegment failed: %s - Error code: (0x%x)\n",
+            SCIGetErrorString(error), error);
+    exit(EXIT_FAILURE);
+  }
+
+  dma->pio_local = local_segment;
+  dma->pio_remote = remote;
+  dma->pio_src = local;
+}
+
+// Write-combined stores into the mapped remote segment, flushed out at the end
+static void pio_write(struct dma *dma, size_t local_offset,
+    size_t remote_offset, size_t size)
+{
+  memcpy((uint8_t *)dma->pio_dst + remote_offset, dma->pio_src + local_offset,
+      size);
+  SCIFlush(NULL, NO_FLAGS);
+}
+
+void dma_transfer_init(struct dma *dma, struct dma_transfer *t)
+{
+  t->dma = dma;
+  t->chunks = 0;
+  t->done = 0;
+  t->failed = 0;
+}
+
+/* Runs when a chunk has completed */
+static sci_callback_action_t chunk_done(void *arg, sci_dma_queue_t queue,
+    sci_error_t status)
+{
+  struct dma_transfer *t = arg;
+  int i;
+
+  if (status != SCI_ERR_OK) { t->failed = status; }
+
+  for (i = 0; i < t->dma->num_queues; ++i)
+  {
+    if (t->dma->queues[i] == queue)
+    {
+      __sync_fetch_and_sub(&t->dma->outstanding[i], 1);
+    }
+  }
+
+  __sync_fetch_and_add(&t->done, 1);
+
+  return SCI_CALLBACK_CONTINUE;
+}
+
+static void dma_start_dma(struct dma_transfer *t, sci_local_segment_t local,
+    sci_remote_segment_t remote, size_t local_offset, size_t remote_offset,
+    size_t size)
+{
+  struct dma *dma = t->dma;
+  size_t chunk = dma->chunk_size ? dma->chunk_size : size;
+  size_t offset;
+  sci_error_t error;
+
+  for (offset = 0; offset < size; offset += chunk)
+  {
+    size_t len = size - offset < chunk ? size - offset : chunk;
+    int q = dma->next;
+
+    dma->next = (dma->next + 1) % dma->num_queues;
+
+    // queue is full, wait for one of its chunks to finish
+    while (dma->outstanding[q] >= DMA_QUEUE_ENTRIES);
+
+    __sync_fetch_and_add(&dma->outstanding[q], 1);
+    ++t->chunks;
+
+    SCIStartDmaTransfer(dma->queues[q],
+                        local,
+                        remote,
+                        local_offset + offset,
+                        len,
+                        remote_offset + offset,
+                        chunk_done,
+                        t,
+                        SCI_FLAG_USE_CALLBACK,
+                        &error);
+    if(error != SCI_ERR_OK){
+      fprintf(stderr, "SCIStartDmaTransfer failed: %s - Error code: (0x%x)\n",
+              SCIGetErrorString(error), error);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void dma_start(struct dma_transfer *t, sci_local_segment_t local,
+    sci_remote_segment_t remote, size_t local_offset, size_t remote_offset,
+    size_t size)
+{
+  struct dma *dma = t->dma;
+
+  /* Small transfers are done by the time this returns. PIO copies from
+     the mapping of pio_local, so it is only used for that pair */
+  if (size < dma->pio_threshold && dma->pio_dst && local == dma->pio_local &&
+      remote == dma->pio_remote)
+  {
+    pio_write(dma, local_offset, remote_offset, size);
+    return;
+  }
+
+  dma_start_dma(t, local, remote, local_offset, remote_offset, size);
+}
+
+int dma_transfer_done(struct dma_transfer *t)
+{
+  if (t->failed)
+  {
+    fprintf(stderr, "DMA transfer failed: %s - Error code: (0x%x)\n",
+            SCIGetErrorString(t->failed), t->failed);
+    exit(EXIT_FAILURE);
+  }
+
+  return t->done == t->chunks;
+}
+
+void dma_transfer_wait(struct dma_transfer *t)
+{
+  while (!dma_transfer_done(t));
+}
+
+static double seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+size_t dma_calibrate(struct dma *dma, sci_local_segment_t local, size_t max_size)
+{
+  const int rounds = 50;
+  size_t size;
+  double start, pio, dmat;
+  int i;
+
+  for (size = 256; size <= max_size; size *= 2)
+  {
+    start = seconds();
+    for (i = 0; i < rounds; ++i) { pio_write(dma, 0, 0, size); }
+    pio = seconds() - start;
+
+    start = seconds();
+    for (i = 0; i < rounds; ++i)
+    {
+      struct dma_transfer t;
+      dma_transfer_init(dma, &t);
+      // bypass the threshold, it is what is being measured
+      dma_start_dma(&t, local, dma->pio_remote, 0, 0, size);
+      dma_transfer_wait(&t);
+    }
+    dmat = seconds() - start;
+
+    if (dmat < pio) { return size; }
+  }
+
+  // PIO won everywhere
+  return max_size;
+}
@@ -0,0 +1,71 @@
+#ifndef C63_DMA_H_
+#define C63_DMA_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sisci_api.h>
+
+#define DMA_MAX_QUEUES 8
+#define DMA_QUEUE_ENTRIES 16
+
+/* Chunked DMA over several queues. Large transfers are split into
+   chunk_size pieces posted round robin on num_queues queues, so several
+   transfers are in flight on the link at once. Completion is counted per
+   chunk in a callback, so a transfer can be waited for while later ones
+   are still in flight.
+
+   Once a local and remote segment pair is mapped with dma_map_pio,
+   transfers between them below pio_threshold bytes are written with PIO
+   stores instead, which skips the DMA setup latency. */
+struct dma
+{
+  sci_dma_queue_t queues[DMA_MAX_QUEUES];
+  int num_queues;
+  size_t chunk_size;                          //0 sends each transfer whole
+  int next;                                   //round robin queue
+  volatile int outstanding[DMA_MAX_QUEUES];   //chunks in flight per queue
+
+  size_t pio_threshold;                       //0 sends everything by DMA
+  sci_local_segment_t pio_local;
+  sci_remote_segment_t pio_remote;
+  sci_map_t pio_map;
+  volatile uint8_t *pio_dst;                  //mapped remote segment
+  const uint8_t *pio_src;                     //mapped local segment
+};
+
+/* One or more dma_start calls that are waited for together */
+struct dma_transfer
+{
+  struct dma *dma;
+  int chunks;
+  volatile int done;
+  volatile int failed;
+};
+
+void dma_init(struct dma *dma, sci_desc_t sd, unsigned int adapter,
+    int num_queues, size_t chunk_size);
+
+void dma_free(struct dma *dma);
+
+/* Map size bytes of remote for PIO. Transfers from local_segment to remote
+   can then be written from local, where local_segment is mapped. */
+void dma_map_pio(struct dma *dma, sci_local_segment_t local_segment,
+    const void *local, sci_remote_segment_t remote, size_t size);
+
+/* Time PIO and DMA for growing transfer sizes up to max_size and return the
+   size from which DMA wins. Overwrites the remote segment. */
+size_t dma_calibrate(struct dma *dma, sci_local_segment_t local, size_t max_size);
+
+void dma_transfer_init(struct dma *dma, struct dma_transfer *t);
+
+/* Post size bytes from the local to the remote segment as part of t */
+void dma_start(struct dma_transfer *t, sci_local_segment_t local,
+    sci_remote_segment_t remote, size_t local_offset, size_t remote_offset,
+    size_t size);
+
+/* Non-zero once every chunk of t has landed */
+int dma_transfer_done(struct dma_transfer *t);
+
+void dma_transfer_wait(struct dma_transfer *t);
+
+#endif  /* C63_DMA_H_ */
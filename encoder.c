@@ -0,0 +1,115 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c63.h"
+#include "common.h"
+#include "encoder.h"
+#include "me_luma.h"
+#include "perf.h"
+#include "tables.h"
+#include "trace.h"
+#include "transform.h"
+
+struct c63_common* init_c63_enc(int width, int height)
+{
+  /* calloc() sets allocated memory to zero */
+  struct c63_common *cm = calloc(1, sizeof(struct c63_common));
+
+  cm->width = width;
+  cm->height = height;
+
+  cm->padw[Y_COMPONENT] = cm->ypw = (uint32_t)(ceil(width/16.0f)*16); //Ypw
+  cm->padh[Y_COMPONENT] = cm->yph = (uint32_t)(ceil(height/16.0f)*16); //Yph
+  cm->padw[U_COMPONENT] = cm->upw = (uint32_t)(ceil(width*UX/(YX*8.0f))*8); //Upw
+  cm->padh[U_COMPONENT] = cm->uph = (uint32_t)(ceil(height*UY/(YY*8.0f))*8); //Uph
+  cm->padw[V_COMPONENT] = cm->vpw = (uint32_t)(ceil(width*VX/(YX*8.0f))*8);  //Vpw
+  cm->padh[V_COMPONENT] = cm->vph = (uint32_t)(ceil(height*VY/(YY*8.0f))*8);  //Vph
+
+  cm->mb_cols = cm->ypw / 8;
+  cm->mb_rows = cm->yph / 8;
+
+  /* Quality parameters -- Home exam deliveries should have original values,
+   i.e., quantization factor should be 25, search range should be 16, and the
+   keyframe interval should be 100. */
+  c63_set_qp(cm, 25);           // Constant quantization factor. Range: [1..50]
+  cm->me_search_range = 16;     // Pixels in every direction
+  cm->keyframe_interval = 100;  // Distance between keyframes
+
+  return cm;
+}
+
+void c63_set_qp(struct c63_common *cm, int qp)
+{
+  int i;
+
+  cm->qp = qp;
+
+  //quantization tables
+  for (i = 0; i < 64; ++i)
+  {
+    cm->quanttbl[Y_COMPONENT][i] = yquanttbl_def[i] / (cm->qp / 10.0);
+    cm->quanttbl[U_COMPONENT][i] = uvquanttbl_def[i] / (cm->qp / 10.0);
+    cm->quanttbl[V_COMPONENT][i] = uvquanttbl_def[i] / (cm->qp / 10.0);
+  }
+}
+
+int c63_start_frame(struct c63_common *cm, yuv_t *image)
+{
+  //Advance to next frame
+  destroy_frame(cm->refframe);
+  cm->refframe = cm->curframe;
+  cm->curframe = create_frame(cm, image);
+
+  //Check if keyframe
+  if (cm->framenum == 0 || cm->frames_since_keyframe == cm->keyframe_interval)
+  {
+    cm->curframe->keyframe = 1;
+    cm->frames_since_keyframe = 0;
+  }
+  else { cm->curframe->keyframe = 0; }
+
+  return !cm->curframe->keyframe;
+}
+
+void c63_encode_frame(struct c63_common *cm, yuv_t *tiled,
+    enum chroma_mv chroma_mv, int luma_done, uint8_t **nz, row_done_t row_done,
+    void *arg)
+{
+  yuv_t *image = cm->curframe->orig;
+  int mb_row;
+
+  if (!cm->curframe->keyframe)
+  {
+    //Motion Estimation
+    trace_begin("me");
+    perf_begin("me");
+    if (luma_done) { me_derive_chroma(cm, chroma_mv == CHROMA_MV_REFINE); }
+    else { me_estimate(cm, chroma_mv); }
+    perf_end("me");
+    trace_end("me");
+  }
+
+  /* Motion compensation, DCT/quantization and reconstruction are fused
+     per block and driven over macroblock rows, so each plane is read once
+     and residuals and recons are written once */
+  for (mb_row = 0; mb_row < cm->padh[Y_COMPONENT]/16; ++mb_row)
+  {
+    trace_begin("row");
+    perf_begin("transform");
+    transform_encode_mb_row(cm, tiled ? tiled : image, tiled != NULL, mb_row,
+        nz);
+    perf_end("transform");
+    trace_end("row");
+
+    if (row_done) { row_done(cm, mb_row, arg); }
+  }
+}
+
+void c63_encode_image(struct c63_common *cm, yuv_t *image, yuv_t *tiled,
+    enum chroma_mv chroma_mv, uint8_t **nz, row_done_t row_done, void *arg)
+{
+  c63_start_frame(cm, image);
+  c63_encode_frame(cm, tiled, chroma_mv, 0, nz, row_done, arg);
+}
@@ -0,0 +1,41 @@
+#ifndef C63_ENCODER_H_
+#define C63_ENCODER_H_
+#include <stdint.h>
+
+#include "c63.h"
+#include "me_luma.h"
+
+/* Frame encoder shared by c63server and the local backend of libc63: motion
+   estimation followed by the fused transform over macroblock rows. The
+   caller writes the frame (or ships it to whoever does) and then bumps
+   cm->framenum and cm->frames_since_keyframe. */
+
+// Called when a macroblock row of the current frame is fully encoded
+typedef void (*row_done_t)(struct c63_common *cm, int mb_row, void *arg);
+
+struct c63_common *init_c63_enc(int width, int height);
+
+/* Quantization factor, 1..50, and the quantization tables that follow
+   from it */
+void c63_set_qp(struct c63_common *cm, int qp);
+
+/* tiled is NULL for raster input, otherwise it holds the same planes in
+   block-tiled layout and is used as the transform source. nz receives the
+   per block info of transform_encode_mb_row and may be NULL, as may
+   row_done. image becomes curframe->orig and is read until this returns. */
+void c63_encode_image(struct c63_common *cm, yuv_t *image, yuv_t *tiled,
+    enum chroma_mv chroma_mv, uint8_t **nz, row_done_t row_done, void *arg);
+
+/* c63_encode_image in two steps, for a caller that has the planes of a
+   frame one at a time. c63_start_frame advances to the next frame and
+   decides whether it is a keyframe, it returns 1 for an inter frame; only
+   the frame's Y plane has to be there yet. With chroma vectors derived
+   from luma, the caller can then run me_estimate_luma and pass luma_done
+   to c63_encode_frame, which does the rest once all planes are in. */
+int c63_start_frame(struct c63_common *cm, yuv_t *image);
+
+void c63_encode_frame(struct c63_common *cm, yuv_t *tiled,
+    enum chroma_mv chroma_mv, int luma_done, uint8_t **nz, row_done_t row_done,
+    void *arg);
+
+#endif  /* C63_ENCODER_H_ */
@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c63.h"
+#include "c63_write.h"
+#include "common.h"
+#include "encoder.h"
+#include "libc63.h"
+#include "me_luma.h"
+#include "transform.h"
+
+// A submitted frame waiting for the encoder thread
+struct slot
+{
+  yuv_t image;
+  void *tag;
+};
+
+struct packet_node
+{
+  struct c63_packet packet;
+  struct packet_node *next;
+};
+
+struct c63_encoder
+{
+  struct c63_common *cm;
+  enum chroma_mv chroma_mv;
+  c63_packet_cb on_packet;
+  void *opaque;
+
+  /* cm->e_ctx.fp, write_frame appends the frame to buf through it */
+  FILE *out;
+  uint8_t *buf;
+  size_t size;
+  size_t capacity;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          //any change below, broadcast
+
+  struct slot *slots;           //ring of max_in_flight
+  int max_in_flight;
+  int head;
+  int queued;
+  int in_flight;                //submitted and not yet delivered
+  struct packet_node *done;     //finished, waiting for c63_poll_packets
+  struct packet_node *done_tail;
+  int closing;
+};
+
+/* The block kernels are global (transform_select), so encoders that are
+   open at the same time have to use the same transform */
+static pthread_mutex_t transform_lock = PTHREAD_MUTEX_INITIALIZER;
+static int open_encoders = 0;
+static enum transform_type open_transform;
+
+static int transform_acquire(enum transform_type type)
+{
+  int ok = 1;
+
+  pthread_mutex_lock(&transform_lock);
+  if (!open_encoders)
+  {
+    transform_select(type);
+    open_transform = type;
+  }
+  else if (open_transform != type)
+  {
+    ok = 0;
+  }
+  if (ok) { ++open_encoders; }
+  pthread_mutex_unlock(&transform_lock);
+
+  return ok;
+}
+
+static void transform_release(void)
+{
+  pthread_mutex_lock(&transform_lock);
+  --open_encoders;
+  pthread_mutex_unlock(&transform_lock);
+}
+
+static enum transform_type map_transform(enum c63_transform transform)
+{
+  switch (transform)
+  {
+    case C63_DCT_FLOAT:
+      return TRANSFORM_FLOAT;
+    case C63_DCT_INT:
+      return TRANSFORM_INT;
+    default:
+      return TRANSFORM_DEFAULT;
+  }
+}
+
+static enum chroma_mv map_chroma_mv(enum c63_chroma_mv chroma_mv)
+{
+  switch (chroma_mv)
+  {
+    case C63_CHROMA_DERIVE:
+      return CHROMA_MV_DERIVE;
+    case C63_CHROMA_REFINE:
+      return CHROMA_MV_REFINE;
+    default:
+      return CHROMA_MV_SEARCH;
+  }
+}
+
+static ssize_t packet_write(void *cookie, const char *data, size_t size)
+{
+  struct c63_encoder *enc = cookie;
+
+  if (enc->size + size > enc->capacity)
+  {
+    size_t capacity = enc->capacity ? enc->capacity : 64*1024;
+    uint8_t *buf;
+
+    while (capacity < enc->size + size) { capacity *= 2; }
+
+    buf = realloc(enc->buf, capacity);
+    if (!buf) { return -1; }
+
+    enc->buf = buf;
+    enc->capacity = capacity;
+  }
+
+  memcpy(enc->buf + enc->size, data, size);
+  enc->size += size;
+
+  return size;
+}
+
+static void deliver(struct c63_encoder *enc, struct c63_packet *packet)
+{
+  struct packet_node *node;
+
+  if (enc->on_packet)
+  {
+    enc->on_packet(enc->opaque, packet);
+
+    pthread_mutex_lock(&enc->lock);
+    --enc->in_flight;
+    pthread_cond_broadcast(&enc->cond);
+    pthread_mutex_unlock(&enc->lock);
+    return;
+  }
+
+  // the buffer goes with the packet, the next frame starts a new one
+  node = malloc(sizeof(*node));
+  node->packet = *packet;
+  node->next = NULL;
+  enc->buf = NULL;
+  enc->capacity = 0;
+
+  pthread_mutex_lock(&enc->lock);
+  if (enc->done_tail) { enc->done_tail->next = node; }
+  else { enc->done = node; }
+  enc->done_tail = node;
+  pthread_cond_broadcast(&enc->cond);
+  pthread_mutex_unlock(&enc->lock);
+}
+
+static void *encode_thread(void *arg)
+{
+  struct c63_encoder *enc = arg;
+  struct c63_common *cm = enc->cm;
+  struct c63_packet packet;
+  yuv_t image;
+  void *tag;
+
+  while (1)
+  {
+    pthread_mutex_lock(&enc->lock);
+    while (!enc->queued && !enc->closing)
+    {
+      pthread_cond_wait(&enc->cond, &enc->lock);
+    }
+
+    // closing, but what was submitted is still encoded
+    if (!enc->queued)
+    {
+      pthread_mutex_unlock(&enc->lock);
+      break;
+    }
+
+    image = enc->slots[enc->head].image;
+    tag = enc->slots[enc->head].tag;
+    enc->head = (enc->head + 1) % enc->max_in_flight;
+    --enc->queued;
+    pthread_mutex_unlock(&enc->lock);
+
+    c63_encode_image(cm, &image, NULL, enc->chroma_mv, NULL, NULL, NULL);
+
+    enc->size = 0;
+    write_frame(cm);
+    fflush(enc->out);
+
+    packet.data = enc->buf;
+    packet.size = enc->size;
+    packet.tag = tag;
+    packet.frame = cm->framenum;
+    packet.keyframe = cm->curframe->keyframe;
+
+    ++cm->framenum;
+    ++cm->frames_since_keyframe;
+
+    deliver(enc, &packet);
+  }
+
+  return NULL;
+}
+
+struct c63_encoder *c63_encoder_open(const struct c63_params *params,
+    enum c63_backend backend)
+{
+  cookie_io_functions_t io = { NULL, packet_write, NULL, NULL };
+  struct c63_encoder *enc;
+
+  if (backend != C63_BACKEND_LOCAL || params->width <= 0 ||
+      params->height <= 0 || params->qp < 0 || params->qp > 50 ||
+      params->max_in_flight < 0 || params->transform > C63_DCT_INT ||
+      params->chroma_mv > C63_CHROMA_REFINE)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (!transform_acquire(map_transform(params->transform)))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  enc = calloc(1, sizeof(*enc));
+  enc->chroma_mv = map_chroma_mv(params->chroma_mv);
+  enc->on_packet = params->on_packet;
+  enc->opaque = params->opaque;
+  enc->max_in_flight = params->max_in_flight ? params->max_in_flight : 2;
+  enc->slots = calloc(enc->max_in_flight, sizeof(struct slot));
+
+  enc->cm = init_c63_enc(params->width, params->height);
+  if (params->qp) { c63_set_qp(enc->cm, params->qp); }
+  if (params->keyframe_interval) { enc->cm->keyframe_interval = params->keyframe_interval; }
+  if (params->search_range) { enc->cm->me_search_range = params->search_range; }
+
+  enc->out = fopencookie(enc, "w", io);
+  enc->cm->e_ctx.fp = enc->out;
+
+  pthread_mutex_init(&enc->lock, NULL);
+  pthread_cond_init(&enc->cond, NULL);
+
+  if (!enc->out || pthread_create(&enc->thread, NULL, encode_thread, enc))
+  {
+    if (enc->out) { fclose(enc->out); }
+    free(enc->cm);
+    free(enc->slots);
+    free(enc);
+    transform_release();
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  return enc;
+}
+
+void c63_encoder_plane_size(struct c63_encoder *enc, int c, int *width,
+    int *height)
+{
+  *width = enc->cm->padw[c];
+  *height = enc->cm->padh[c];
+}
+
+int c63_submit_frame(struct c63_encoder *enc, uint8_t *y, uint8_t *u,
+    uint8_t *v, void *tag)
+{
+  struct slot *slot;
+
+  pthread_mutex_lock(&enc->lock);
+  while (enc->in_flight == enc->max_in_flight && !enc->closing)
+  {
+    pthread_cond_wait(&enc->cond, &enc->lock);
+  }
+
+  if (enc->closing)
+  {
+    pthread_mutex_unlock(&enc->lock);
+    return -1;
+  }
+
+  slot = &enc->slots[(enc->head + enc->queued) % enc->max_in_flight];
+  slot->image.Y = y;
+  slot->image.U = u;
+  slot->image.V = v;
+  slot->tag = tag;
+  ++enc->queued;
+  ++enc->in_flight;
+
+  pthread_cond_broadcast(&enc->cond);
+  pthread_mutex_unlock(&enc->lock);
+
+  return 0;
+}
+
+int c63_poll_packets(struct c63_encoder *enc, struct c63_packet *packet,
+    int wait)
+{
+  struct packet_node *node;
+
+  pthread_mutex_lock(&enc->lock);
+  while (wait && !enc->done && enc->in_flight)
+  {
+    pthread_cond_wait(&enc->cond, &enc->lock);
+  }
+
+  node = enc->done;
+  if (node)
+  {
+    enc->done = node->next;
+    if (!enc->done) { enc->done_tail = NULL; }
+    --enc->in_flight;
+    pthread_cond_broadcast(&enc->cond);
+  }
+  pthread_mutex_unlock(&enc->lock);
+
+  if (!node) { return 0; }
+
+  *packet = node->packet;
+  free(node);
+
+  return 1;
+}
+
+void c63_packet_free(struct c63_packet *packet)
+{
+  free(packet->data);
+  packet->data = NULL;
+}
+
+void c63_encoder_close(struct c63_encoder *enc)
+{
+  struct packet_node *node;
+
+  pthread_mutex_lock(&enc->lock);
+  enc->closing = 1;
+  pthread_cond_broadcast(&enc->cond);
+  pthread_mutex_unlock(&enc->lock);
+
+  pthread_join(enc->thread, NULL);
+
+  while ((node = enc->done))
+  {
+    enc->done = node->next;
+    free(node->packet.data);
+    free(node);
+  }
+
+  fclose(enc->out);
+  free(enc->buf);
+
+  destroy_frame(enc->cm->refframe);
+  destroy_frame(enc->cm->curframe);
+  free(enc->cm);
+
+  pthread_mutex_destroy(&enc->lock);
+  pthread_cond_destroy(&enc->cond);
+  free(enc->slots);
+  free(enc);
+
+  transform_release();
+}
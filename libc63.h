@@ -0,0 +1,100 @@
+#ifndef C63_LIBC63_H_
+#define C63_LIBC63_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/* Embeddable encoder. Frames are submitted with a tag and come back as
+   packets, each one the complete bitstream of one frame as c63enc would
+   have written it to its output file, in submission order. Up to
+   max_in_flight frames are submitted but not yet delivered; submitting
+   more blocks until a packet has been delivered, so when polling, poll
+   before submitting more than that.
+
+   Frame buffers are used in place: the three planes of a submitted frame
+   are read by the encoder until the packet with its tag has been
+   delivered, and must be padded to the plane sizes of
+   c63_encoder_plane_size (raster order, stride = width).
+
+   Packets are delivered either to on_packet, called from the encoder
+   thread with data that is only valid during the call, or, without a
+   callback, through c63_poll_packets. */
+/* Only the local backend exists so far. Encoding on a c63server over
+   SISCI needs the client loop of c63enc moved into the library first;
+   until then the library does not use SISCI and links with -lm -lpthread
+   alone. */
+enum c63_backend
+{
+  C63_BACKEND_LOCAL     //encode on this machine, in a thread of its own
+};
+
+/* DCT of the encoder, a decoder has to be built for the same one. The
+   default is the one the library was built with ('make TRANSFORM=int'). */
+enum c63_transform
+{
+  C63_DCT_DEFAULT,
+  C63_DCT_FLOAT,
+  C63_DCT_INT
+};
+
+/* Chroma motion vectors, as c63server -M */
+enum c63_chroma_mv
+{
+  C63_CHROMA_SEARCH,    //every plane searched
+  C63_CHROMA_DERIVE,    //derived from the luma vectors
+  C63_CHROMA_REFINE     //derived, then the best of the 3x3 around it
+};
+
+struct c63_packet
+{
+  uint8_t *data;
+  size_t size;
+  void *tag;            //as passed to c63_submit_frame
+  int frame;            //frame number in the stream
+  int keyframe;
+};
+
+typedef void (*c63_packet_cb)(void *opaque, const struct c63_packet *packet);
+
+struct c63_params
+{
+  int width;
+  int height;
+  int qp;                       //0 for the default of 25
+  int keyframe_interval;        //0 for the default of 100
+  int search_range;             //0 for the default of 16
+  enum c63_transform transform;
+  enum c63_chroma_mv chroma_mv;
+  int max_in_flight;            //0 for 2
+  c63_packet_cb on_packet;      //NULL to poll
+  void *opaque;                 //passed to on_packet
+};
+
+struct c63_encoder;
+
+/* NULL on failure with errno set, EINVAL for bad params or if another
+   open encoder uses a different transform */
+struct c63_encoder *c63_encoder_open(const struct c63_params *params,
+    enum c63_backend backend);
+
+/* Padded size of plane c (0 Y, 1 U, 2 V) */
+void c63_encoder_plane_size(struct c63_encoder *enc, int c, int *width,
+    int *height);
+
+/* Queue a frame, blocks while max_in_flight frames are in flight.
+   Returns 0, or -1 once the encoder is closing. */
+int c63_submit_frame(struct c63_encoder *enc, uint8_t *y, uint8_t *u,
+    uint8_t *v, void *tag);
+
+/* Take the next finished packet. With wait set this blocks until one is
+   done or nothing is in flight. Returns 1 with *packet filled in, to be
+   released with c63_packet_free, or 0 if there is none. */
+int c63_poll_packets(struct c63_encoder *enc, struct c63_packet *packet,
+    int wait);
+
+void c63_packet_free(struct c63_packet *packet);
+
+/* Encodes what has been submitted, delivers it to on_packet or drops what
+   was not polled, and frees the encoder */
+void c63_encoder_close(struct c63_encoder *enc);
+
+#endif  /* C63_LIBC63_H_ */
@@ -0,0 +1,193 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c63.h"
+#include "dsp.h"
+#include "me.h"
+#include "me_luma.h"
+
+enum chroma_mv chroma_mv_parse(const char *name)
+{
+  if (!strcmp(name, "search")) { return CHROMA_MV_SEARCH; }
+  if (!strcmp(name, "derive")) { return CHROMA_MV_DERIVE; }
+  if (!strcmp(name, "refine")) { return CHROMA_MV_REFINE; }
+
+  fprintf(stderr, "Unknown chroma mode %s, use search, derive or refine\n", name);
+  exit(EXIT_FAILURE);
+}
+
+const char *chroma_mv_name(enum chroma_mv mode)
+{
+  switch (mode)
+  {
+    case CHROMA_MV_DERIVE: return "derived";
+    case CHROMA_MV_REFINE: return "derived and refined";
+    default: return "searched";
+  }
+}
+
+/* Same window as me_block_8x8 in me.c: range pixels in every direction,
+   cut at the plane borders */
+static void me_block_luma(struct c63_common *cm, int mb_x, int mb_y,
+    uint8_t *orig, uint8_t *ref)
+{
+  struct macroblock *mb = &cm->curframe->mbs[Y_COMPONENT][mb_y*cm->padw[Y_COMPONENT]/8+mb_x];
+  int range = cm->me_search_range;
+  int w = cm->padw[Y_COMPONENT];
+  int h = cm->padh[Y_COMPONENT];
+  int mx = mb_x * 8;
+  int my = mb_y * 8;
+  int left = mx - range;
+  int top = my - range;
+  int right = mx + range;
+  int bottom = my + range;
+  int best_sad = INT_MAX;
+  int x, y, sad;
+
+  if (left < 0) { left = 0; }
+  if (top < 0) { top = 0; }
+  if (right > (w - 8)) { right = w - 8; }
+  if (bottom > (h - 8)) { bottom = h - 8; }
+
+  for (y = top; y < bottom; ++y)
+  {
+    for (x = left; x < right; ++x)
+    {
+      sad_block_8x8(orig + my*w+mx, ref + y*w+x, w, &sad);
+
+      if (sad < best_sad)
+      {
+        mb->mv_x = x - mx;
+        mb->mv_y = y - my;
+        best_sad = sad;
+      }
+    }
+  }
+
+  mb->use_mv = 1;
+}
+
+void me_estimate_luma(struct c63_common *cm)
+{
+  int mb_x, mb_y;
+
+  for (mb_y = 0; mb_y < cm->mb_rows; ++mb_y)
+  {
+    for (mb_x = 0; mb_x < cm->mb_cols; ++mb_x)
+    {
+      me_block_luma(cm, mb_x, mb_y, cm->curframe->orig->Y,
+          cm->refframe->recons->Y);
+    }
+  }
+}
+
+/* Sum of four luma components in luma pixels to one chroma component,
+   sum/8 rounded half away from zero */
+static int derive_component(int sum)
+{
+  return sum >= 0 ? (sum + 4) / 8 : -((-sum + 4) / 8);
+}
+
+static int clamp(int v, int lo, int hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Best vector of the 3x3 neighbourhood of the derived one, which wins
+   ties */
+static void refine_block(uint8_t *orig, uint8_t *ref, int w, int h, int bx,
+    int by, struct macroblock *mb)
+{
+  int cx = bx + mb->mv_x;
+  int cy = by + mb->mv_y;
+  int best_x = cx, best_y = cy;
+  int best_sad, sad, dx, dy;
+
+  sad_block_8x8(orig + by*w+bx, ref + cy*w+cx, w, &best_sad);
+
+  for (dy = -1; dy <= 1; ++dy)
+  {
+    for (dx = -1; dx <= 1; ++dx)
+    {
+      int x = cx + dx, y = cy + dy;
+
+      if ((!dx && !dy) || x < 0 || y < 0 || x > w - 8 || y > h - 8)
+      {
+        continue;
+      }
+
+      sad_block_8x8(orig + by*w+bx, ref + y*w+x, w, &sad);
+
+      if (sad < best_sad)
+      {
+        best_x = x;
+        best_y = y;
+        best_sad = sad;
+      }
+    }
+  }
+
+  mb->mv_x = best_x - bx;
+  mb->mv_y = best_y - by;
+}
+
+void me_derive_chroma(struct c63_common *cm, int refine)
+{
+  struct macroblock *luma = cm->curframe->mbs[Y_COMPONENT];
+  int luma_cols = cm->padw[Y_COMPONENT]/8;
+  int c, x, y, i, j;
+
+  for (c = U_COMPONENT; c <= V_COMPONENT; ++c)
+  {
+    int w = cm->padw[c];
+    int h = cm->padh[c];
+    uint8_t *orig = c == U_COMPONENT ? cm->curframe->orig->U : cm->curframe->orig->V;
+    uint8_t *ref = c == U_COMPONENT ? cm->refframe->recons->U : cm->refframe->recons->V;
+
+    for (y = 0; y < h/8; ++y)
+    {
+      for (x = 0; x < w/8; ++x)
+      {
+        struct macroblock *mb = &cm->curframe->mbs[c][y*(w/8) + x];
+        int sum_x = 0, sum_y = 0;
+
+        // the four co-located luma blocks
+        for (j = 0; j < 2; ++j)
+        {
+          for (i = 0; i < 2; ++i)
+          {
+            const struct macroblock *l = &luma[(2*y+j)*luma_cols + 2*x+i];
+
+            if (l->use_mv)
+            {
+              sum_x += l->mv_x;
+              sum_y += l->mv_y;
+            }
+          }
+        }
+
+        // keep the block inside the plane, like the search window does
+        mb->mv_x = clamp(derive_component(sum_x), -x*8, w - 8 - x*8);
+        mb->mv_y = clamp(derive_component(sum_y), -y*8, h - 8 - y*8);
+        mb->use_mv = 1;
+
+        if (refine) { refine_block(orig, ref, w, h, x*8, y*8, mb); }
+      }
+    }
+  }
+}
+
+void me_estimate(struct c63_common *cm, enum chroma_mv mode)
+{
+  if (mode == CHROMA_MV_SEARCH)
+  {
+    c63_motion_estimate(cm);
+    return;
+  }
+
+  me_estimate_luma(cm);
+  me_derive_chroma(cm, mode == CHROMA_MV_REFINE);
+}
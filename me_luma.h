@@ -0,0 +1,36 @@
+#ifndef C63_ME_LUMA_H_
+#define C63_ME_LUMA_H_
+#include "c63.h"
+
+/* Luma-only motion estimation. c63_motion_estimate in me.c searches the
+   U and V planes on their own, at half the range, which is about a third
+   of the search cost of an inter frame. With 4:2:0 the chroma block at
+   (x, y) covers the same picture area as the luma blocks (2x..2x+1,
+   2y..2y+1), so its vector can be derived from theirs instead. The
+   vectors still go into curframe->mbs of every plane, the bitstream and
+   the decoder do not change. */
+enum chroma_mv
+{
+  CHROMA_MV_SEARCH,   //c63_motion_estimate, every plane searched
+  CHROMA_MV_DERIVE,   //half the mean of the four luma vectors
+  CHROMA_MV_REFINE    //derived, then the best of the 3x3 around it
+};
+
+/* Parse "search", "derive" or "refine", exits on anything else */
+enum chroma_mv chroma_mv_parse(const char *name);
+
+const char *chroma_mv_name(enum chroma_mv mode);
+
+/* Motion estimation of every plane of curframe against refframe->recons
+   with the given chroma mode */
+void me_estimate(struct c63_common *cm, enum chroma_mv mode);
+
+/* Full search of the luma plane only, same search window and cost as
+   c63_motion_estimate */
+void me_estimate_luma(struct c63_common *cm);
+
+/* Chroma vectors from the luma vectors in curframe->mbs[Y_COMPONENT],
+   optionally refined by +-1 pixel */
+void me_derive_chroma(struct c63_common *cm, int refine);
+
+#endif  /* C63_ME_LUMA_H_ */
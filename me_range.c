@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c63.h"
+#include "me_range.h"
+
+int me_range_parse(const char *arg, int *min, int *max)
+{
+  if (sscanf(arg, "%d,%d", min, max) != 2) { return 0; }
+
+  return *min >= 1 && *min <= *max && *max <= ME_RANGE_LIMIT;
+}
+
+static int clamp(int v, int lo, int hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+void me_range_init(struct me_range *r, int min, int max, int initial)
+{
+  memset(r, 0, sizeof(*r));
+  r->min = min;
+  r->max = max;
+  r->range = clamp(initial, min, max);
+}
+
+int me_range_update(struct me_range *r, const struct c63_common *cm)
+{
+  const struct macroblock *mbs = cm->curframe->mbs[Y_COMPONENT];
+  int hist[ME_RANGE_LIMIT + 1];
+  int n = cm->mb_rows * cm->mb_cols;
+  int edge = 0;
+  int i, len, count, need;
+
+  memset(hist, 0, sizeof(hist));
+
+  for (i = 0; i < n; ++i)
+  {
+    int x = mbs[i].mv_x;
+    int y = mbs[i].mv_y;
+
+    /* The window is [-range, range) in each direction, see
+       me_block_8x8 */
+    if (x <= -r->range || x >= r->range - 1 || y <= -r->range || y >= r->range - 1)
+    {
+      ++edge;
+    }
+
+    len = abs(x) > abs(y) ? abs(x) : abs(y);
+    ++hist[len > ME_RANGE_LIMIT ? ME_RANGE_LIMIT : len];
+  }
+
+  // shortest length that 95% of the vectors are within
+  for (len = 0, count = hist[0]; count*100 < n*95; count += hist[++len]);
+
+  r->percentile = len;
+  r->edge_percent = 100.0 * edge / n;
+  r->recent[r->num_recent++ % ME_RANGE_FRAMES] = len;
+
+  if (edge*100 > n*ME_RANGE_EDGE_PERCENT)
+  {
+    r->range = clamp(r->range*2, r->min, r->max);
+    return r->range;
+  }
+
+  need = 0;
+  for (i = 0; i < ME_RANGE_FRAMES && i < r->num_recent; ++i)
+  {
+    if (r->recent[i] > need) { need = r->recent[i]; }
+  }
+  need += ME_RANGE_MARGIN;
+
+  if (need < r->range - r->range/4) { need = r->range - r->range/4; }
+
+  r->range = clamp(need, r->min, r->max);
+
+  return r->range;
+}
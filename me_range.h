@@ -0,0 +1,38 @@
+#ifndef C63_ME_RANGE_H_
+#define C63_ME_RANGE_H_
+#include "c63.h"
+
+/* Per frame motion search range. After every inter frame the luma vectors
+   are looked at: if many of them sit on the edge of the search window the
+   motion is probably larger than the window, and the range is doubled at
+   once. Otherwise it follows the largest 95th percentile vector length of
+   the last ME_RANGE_FRAMES frames plus a margin, shrinking by at most a
+   quarter per frame so a single still frame does not collapse it. The
+   range is what cm->me_search_range is set to before motion estimation,
+   so me.c and me_luma.c both follow it. */
+#define ME_RANGE_FRAMES 8
+#define ME_RANGE_MARGIN 2
+#define ME_RANGE_EDGE_PERCENT 5
+#define ME_RANGE_LIMIT 64       //vectors are stored as int8_t
+
+struct me_range
+{
+  int min, max;
+  int range;                    //for the next frame
+  int recent[ME_RANGE_FRAMES];  //95th percentile of the last frames
+  int num_recent;
+  // of the last update, for the log
+  int percentile;
+  double edge_percent;
+};
+
+/* Parse "min,max" into min and max, returns 0 if it is not valid */
+int me_range_parse(const char *arg, int *min, int *max);
+
+void me_range_init(struct me_range *r, int min, int max, int initial);
+
+/* Update from the luma vectors of cm->curframe, which must be an inter
+   frame estimated with the current range. Returns the next range. */
+int me_range_update(struct me_range *r, const struct c63_common *cm);
+
+#endif  /* C63_ME_RANGE_H_ */
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_##cache | \
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+  const char *name;     //for -E
+  const char *label;    //in the report
+  uint32_t type;
+  uint64_t config;
+} counters[PERF_COUNTERS] =
+{
+  { "cycles", "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d", "L1D", PERF_TYPE_HW_CACHE, CACHE_MISS(L1D) },
+  { "llc", "LLC", PERF_TYPE_HW_CACHE, CACHE_MISS(LL) },
+  { "branch", "branch", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "dtlb", "dTLB", PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB) }
+};
+
+struct perf_count
+{
+  uint64_t ns;
+  uint64_t val[PERF_COUNTERS];
+};
+
+struct perf_stage
+{
+  const char *name;
+  struct perf_count start;    //at perf_begin
+  struct perf_count frame;    //current frame
+  struct perf_count total;
+};
+
+static unsigned selected;     //bit per counter, 0 until perf_init
+static int fds[PERF_COUNTERS];
+static int opened;
+static pthread_t owner;
+
+static struct perf_stage stages[PERF_STAGES];
+static int num_stages;
+
+// PERF_STAGES counts for every finished frame
+static struct perf_count *frames;
+static int num_frames;
+static int max_frames;
+
+void perf_init(const char *list)
+{
+  char *names = strdup(list);
+  char *name, *save;
+  int c;
+
+  for (name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save))
+  {
+    if (!strcmp(name, "all"))
+    {
+      selected = (1 << PERF_COUNTERS) - 1;
+      continue;
+    }
+
+    for (c = 0; c < PERF_COUNTERS && strcmp(name, counters[c].name); ++c);
+
+    if (c == PERF_COUNTERS)
+    {
+      fprintf(stderr, "Unknown counter %s, use cycles, instructions, l1d, llc, branch, dtlb or all\n", name);
+      exit(EXIT_FAILURE);
+    }
+
+    selected |= 1 << c;
+  }
+
+  free(names);
+}
+
+int perf_counter_open(enum perf_counter counter)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = counters[counter].type;
+  attr.size = sizeof(attr);
+  attr.config = counters[counter].config;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+uint64_t perf_counter_read(int fd)
+{
+  uint64_t buf[3];    //value, time enabled, time running
+
+  if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+  {
+    return 0;
+  }
+
+  // estimate for the time the counter was multiplexed out
+  return buf[2] == buf[1] ? buf[0] : (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+}
+
+void perf_open(void)
+{
+  int c;
+
+  if (!selected) { return; }
+
+  for (c = 0; c < PERF_COUNTERS; ++c)
+  {
+    // not selected, not supported or not permitted, the report goes without it
+    fds[c] = selected & (1 << c) ? perf_counter_open(c) : -1;
+  }
+
+  owner = pthread_self();
+  opened = 1;
+}
+
+int perf_enabled(void)
+{
+  return opened;
+}
+
+static void read_counts(struct perf_count *count)
+{
+  struct timespec ts;
+  int c;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  count->ns = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+
+  for (c = 0; c < PERF_COUNTERS; ++c)
+  {
+    count->val[c] = perf_counter_read(fds[c]);
+  }
+}
+
+static struct perf_stage *find_stage(const char *name)
+{
+  int i;
+
+  if (!opened || !pthread_equal(owner, pthread_self())) { return NULL; }
+
+  for (i = 0; i < num_stages; ++i)
+  {
+    if (stages[i].name == name || !strcmp(stages[i].name, name))
+    {
+      return &stages[i];
+    }
+  }
+
+  if (num_stages == PERF_STAGES) { return NULL; }
+
+  stages[num_stages].name = name;
+
+  return &stages[num_stages++];
+}
+
+void perf_begin(const char *name)
+{
+  struct perf_stage *stage = find_stage(name);
+
+  if (stage) { read_counts(&stage->start); }
+}
+
+void perf_end(const char *name)
+{
+  struct perf_stage *stage = find_stage(name);
+  struct perf_count now;
+  int c;
+
+  if (!stage) { return; }
+
+  read_counts(&now);
+
+  stage->frame.ns += now.ns - stage->start.ns;
+  for (c = 0; c < PERF_COUNTERS; ++c)
+  {
+    stage->frame.val[c] += now.val[c] - stage->start.val[c];
+  }
+}
+
+void perf_frame(void)
+{
+  int i, c;
+
+  if (!opened || !pthread_equal(owner, pthread_self())) { return; }
+
+  if (num_frames == max_frames)
+  {
+    max_frames = max_frames ? 2*max_frames : 256;
+    frames = realloc(frames, max_frames * PERF_STAGES * sizeof(struct perf_count));
+  }
+
+  for (i = 0; i < PERF_STAGES; ++i)
+  {
+    struct perf_count *frame = &stages[i].frame;
+
+    frames[num_frames*PERF_STAGES + i] = *frame;
+
+    stages[i].total.ns += frame->ns;
+    for (c = 0; c < PERF_COUNTERS; ++c)
+    {
+      stages[i].total.val[c] += frame->val[c];
+    }
+
+    memset(frame, 0, sizeof(*frame));
+  }
+
+  ++num_frames;
+}
+
+static int have(int c)
+{
+  return fds[c] >= 0;
+}
+
+/* Time, IPC and misses per 1000 instructions */
+static void print_rates(FILE *fp, const struct perf_count *count, double ms)
+{
+  int c;
+
+  fprintf(fp, "%9.2f ms", ms);
+
+  if (have(PERF_CYCLES) && have(PERF_INSTRUCTIONS) && count->val[PERF_CYCLES])
+  {
+    fprintf(fp, "  IPC %5.2f",
+        (double)count->val[PERF_INSTRUCTIONS] / count->val[PERF_CYCLES]);
+  }
+
+  for (c = PERF_L1D_MISSES; c < PERF_COUNTERS; ++c)
+  {
+    if (!have(c)) { continue; }
+
+    if (have(PERF_INSTRUCTIONS) && count->val[PERF_INSTRUCTIONS])
+    {
+      fprintf(fp, "  %s %6.2f", counters[c].label,
+          1000.0 * count->val[c] / count->val[PERF_INSTRUCTIONS]);
+    }
+    else
+    {
+      fprintf(fp, "  %s %" PRIu64, counters[c].label, count->val[c]);
+    }
+  }
+
+  fprintf(fp, "\n");
+}
+
+void perf_report(FILE *fp)
+{
+  int f, i, c, any = 0;
+
+  if (!opened) { return; }
+
+  for (c = 0; c < PERF_COUNTERS; ++c) { any |= have(c); }
+
+  if (!any)
+  {
+    fprintf(fp, "Performance counters not available, stage times only\n");
+  }
+  else
+  {
+    fprintf(fp, "Counters:");
+    for (c = 0; c < PERF_COUNTERS; ++c)
+    {
+      if (have(c)) { fprintf(fp, " %s", counters[c].label); }
+    }
+    fprintf(fp, "%s\n", have(PERF_INSTRUCTIONS) ?
+        ", misses per 1000 instructions" : ", misses as counts");
+  }
+
+  for (f = 0; f < num_frames; ++f)
+  {
+    for (i = 0; i < num_stages; ++i)
+    {
+      const struct perf_count *count = &frames[f*PERF_STAGES + i];
+
+      if (!count->ns) { continue; }
+
+      fprintf(fp, "Frame %4d %-10s", f, stages[i].name);
+      print_rates(fp, count, count->ns / 1e6);
+    }
+  }
+
+  fprintf(fp, "Total over %d frames:\n", num_frames);
+  for (i = 0; i < num_stages; ++i)
+  {
+    const struct perf_count *total = &stages[i].total;
+
+    fprintf(fp, "%-10s", stages[i].name);
+    print_rates(fp, total, total->ns / 1e6);
+
+    for (c = 0; c < PERF_COUNTERS; ++c)
+    {
+      if (have(c))
+      {
+        fprintf(fp, "%10s %-12s %" PRIu64 "\n", "", counters[c].label, total->val[c]);
+      }
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef C63_PERF_H_
+#define C63_PERF_H_
+#include <stdint.h>
+#include <stdio.h>
+
+/* Hardware counters per encode stage. Stages are named like trace events
+   and bracketed with perf_begin/perf_end; counts are summed per frame and
+   over the run, and perf_report prints time, IPC and misses per 1000
+   instructions for each. Tells a compute-bound stage from a memory-bound
+   one, on the Tegra as well as on the x86.
+
+   Counters follow the thread that called perf_open, calls from other
+   threads are ignored. Every counter is opened on its own and scaled when
+   the PMU has to multiplex them. Counters the kernel or the PMU refuses
+   are left out, with none at all only the time is reported.
+
+   Nothing is recorded unless perf_init and perf_open have been called. */
+#define PERF_STAGES 16
+
+enum perf_counter
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_COUNTERS
+};
+
+/* counters is a comma separated list of cycles, instructions, l1d, llc,
+   branch and dtlb, or "all" */
+void perf_init(const char *counters);
+
+// Open the counters on the calling thread
+void perf_open(void);
+
+/* A single counter of the calling thread, outside the stages. Returns -1
+   if the kernel or the PMU refuses it. perf_counter_read gives the count
+   so far, scaled if it was multiplexed, and 0 for fd -1. */
+int perf_counter_open(enum perf_counter counter);
+
+uint64_t perf_counter_read(int fd);
+
+int perf_enabled(void);
+
+void perf_begin(const char *stage);
+
+void perf_end(const char *stage);
+
+// Close the counts of the current frame
+void perf_frame(void);
+
+// Per frame lines, then the totals per stage
+void perf_report(FILE *fp);
+
+#endif  /* C63_PERF_H_ */
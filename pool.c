@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+/* One pool_run. It lives on the caller's stack, workers only reach it
+   through pool->job under the lock and are counted in active while they
+   use it, so pool_run does not return (and reuse or free it) under them. */
+struct job
+{
+  pool_fn_t fn;
+  void *arg;
+  int count;
+  volatile int next;            //next index to hand out
+  int done;                     //indexes finished
+  int active;                   //workers inside work() for this job
+};
+
+struct pool
+{
+  pthread_t *threads;
+  int num_threads;              //including the caller of pool_run
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;         //a new job is posted
+  pthread_cond_t finish;        //a worker left the current job
+  int generation;               //bumped for every job
+  int quit;
+
+  struct job *job;              //current job, NULL once it has finished
+};
+
+// Process indexes of job until there are none left, returns how many
+static int work(struct job *job)
+{
+  int i, n = 0;
+
+  while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count)
+  {
+    job->fn(job->arg, i);
+    ++n;
+  }
+
+  return n;
+}
+
+static void *worker(void *arg)
+{
+  struct pool *pool = arg;
+  struct job *job;
+  int generation = 0;
+  int n;
+
+  pthread_mutex_lock(&pool->lock);
+
+  while (1)
+  {
+    while (!pool->quit && pool->generation == generation)
+    {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->quit) { break; }
+
+    generation = pool->generation;
+
+    // woke too late, the job is already over
+    job = pool->job;
+    if (!job) { continue; }
+
+    ++job->active;
+    pthread_mutex_unlock(&pool->lock);
+    n = work(job);
+    pthread_mutex_lock(&pool->lock);
+
+    job->done += n;
+    --job->active;
+    pthread_cond_broadcast(&pool->finish);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+struct pool *pool_create(int num_threads)
+{
+  struct pool *pool = calloc(1, sizeof(struct pool));
+  int i;
+
+  if (num_threads < 1) { num_threads = sysconf(_SC_NPROCESSORS_ONLN); }
+  if (num_threads < 1) { num_threads = 1; }
+
+  pool->num_threads = num_threads;
+  pool->threads = calloc(num_threads, sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->finish, NULL);
+
+  for (i = 1; i < num_threads; ++i)
+  {
+    if (pthread_create(&pool->threads[i], NULL, worker, pool))
+    {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 1; i < pool->num_threads; ++i)
+  {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->finish);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
+
+int pool_size(struct pool *pool)
+{
+  return pool->num_threads;
+}
+
+void pool_run(struct pool *pool, pool_fn_t fn, void *arg, int count)
+{
+  struct job job;
+  int n;
+
+  if (count <= 0) { return; }
+
+  job.fn = fn;
+  job.arg = arg;
+  job.count = count;
+  job.next = 0;
+  job.done = 0;
+  job.active = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->job = &job;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  // the caller takes a share of the work instead of just waiting
+  n = work(&job);
+
+  pthread_mutex_lock(&pool->lock);
+  job.done += n;
+  while (job.done < job.count || job.active)
+  {
+    pthread_cond_wait(&pool->finish, &pool->lock);
+  }
+  pool->job = NULL;
+  pthread_mutex_unlock(&pool->lock);
+}
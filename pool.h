@@ -0,0 +1,20 @@
+#ifndef C63_POOL_H_
+#define C63_POOL_H_
+
+/* Fixed pool of worker threads for data parallel loops. pool_run hands out
+   the indexes 0..count-1 one at a time to the workers and the calling
+   thread, and returns once every index has been processed. */
+struct pool;
+
+typedef void (*pool_fn_t)(void *arg, int index);
+
+/* num_threads counts the calling thread, 0 uses one per online cpu */
+struct pool *pool_create(int num_threads);
+
+void pool_destroy(struct pool *pool);
+
+int pool_size(struct pool *pool);
+
+void pool_run(struct pool *pool, pool_fn_t fn, void *arg, int count);
+
+#endif  /* C63_POOL_H_ */
@@ -2,7 +2,7 @@
 set -e
 
 #
-# USAGE: ./run.sh [--tegra hostname]
+# USAGE: ./run.sh [--tegra hostname] [--trace]
 #
 
 TEGRA_CMD="c63server"
@@ -42,10 +42,17 @@ while [ $# -gt 0 ] ; do
             PC_ARGS=$1
             shift
             ;;
+        --server-args)
+            TEGRA_ARGS=$1
+            shift
+            ;;
         --tegra)
             TEGRA=$1
             shift
             ;;
+        --trace) #Timeline of both nodes in logs/<date>-trace.json
+            TRACE=1
+            ;;
         --pc)
             PC=$1
             shift
@@ -61,6 +68,11 @@ while [ $# -gt 0 ] ; do
     esac
 done
 
+if [ -n "$TRACE" ]; then
+    TEGRA_ARGS="$TEGRA_ARGS -T trace.json"
+    PC_ARGS="$PC_ARGS -T trace.json"
+fi
+
 if [ -z "$PC" ]; then
     if [ "$TEGRA" == "tegra-1" ]; then
         PC="in5050-2014-10"
@@ -108,6 +120,14 @@ stdbuf -oL -eL ssh $PC "cd $BUILD_DIR/x86-build && stdbuf -oL -eL ./$PC_CMD -r $
 
 wait 
 
+if [ -n "$TRACE" ]; then
+    # both files are JSON arrays without a closing ], drop the second [
+    scp -q $PC:$BUILD_DIR/x86-build/trace.json logs/$DATE-pc-trace.json
+    scp -q $TEGRA:$BUILD_DIR/tegra-build/trace.json logs/$DATE-tegra-trace.json
+    (cat logs/$DATE-pc-trace.json; tail -n +2 logs/$DATE-tegra-trace.json) > logs/$DATE-trace.json
+    echo "Trace: logs/$DATE-trace.json (open in chrome://tracing or ui.perfetto.dev)"
+fi
+
 echo "Done!"
 
 quit
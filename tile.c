@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "tile.h"
+
+/* Copy a raster plane into block-tiled order */
+void tile_plane(uint8_t *out_data, const uint8_t *in_data, uint32_t width,
+    uint32_t height)
+{
+  uint32_t x, y;
+  int i;
+
+  for (y = 0; y < height; y += TILE_SIZE)
+  {
+    for (x = 0; x < width; x += TILE_SIZE)
+    {
+      for (i = 0; i < TILE_SIZE; ++i)
+      {
+        memcpy(out_data + i*TILE_SIZE, in_data + (y+i)*width + x, TILE_SIZE);
+      }
+      out_data += TILE_PIXELS;
+    }
+  }
+}
+
+/* Copy a block-tiled plane back to raster order */
+void untile_plane(uint8_t *out_data, const uint8_t *in_data, uint32_t width,
+    uint32_t height)
+{
+  uint32_t x, y;
+  int i;
+
+  for (y = 0; y < height; y += TILE_SIZE)
+  {
+    for (x = 0; x < width; x += TILE_SIZE)
+    {
+      for (i = 0; i < TILE_SIZE; ++i)
+      {
+        memcpy(out_data + (y+i)*width + x, in_data + i*TILE_SIZE, TILE_SIZE);
+      }
+      in_data += TILE_PIXELS;
+    }
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef C63_TILE_H_
+#define C63_TILE_H_
+#include <inttypes.h>
+#include <stdint.h>
+
+/* Block-tiled plane layout. Every 8x8 block is stored as 64 contiguous
+   bytes and the blocks follow each other in raster order. This is the same
+   ordering dct_quantize uses for the residuals, so block n of a tiled plane
+   lines up with coefficients [n*64, n*64+64) of the matching dct plane. */
+#define TILE_SIZE 8
+#define TILE_PIXELS (TILE_SIZE*TILE_SIZE)
+
+// Plane layout of the input segment
+enum layout
+{
+  LAYOUT_RASTER,  //rows of padw bytes, as read from the yuv file
+  LAYOUT_TILED    //8x8 blocks, 64 contiguous bytes each
+};
+
+void tile_plane(uint8_t *out_data, const uint8_t *in_data, uint32_t width,
+    uint32_t height);
+
+void untile_plane(uint8_t *out_data, const uint8_t *in_data, uint32_t width,
+    uint32_t height);
+
+#endif  /* C63_TILE_H_ */
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+
+struct trace_event
+{
+  const char *name;
+  int64_t time;
+  char phase;           //'B' or 'E'
+};
+
+struct trace_buffer
+{
+  struct trace_event events[TRACE_EVENTS];
+  int num_events;
+  int tid;
+  struct trace_buffer *next;
+};
+
+static const char *trace_path;
+static const char *trace_process;
+static int trace_pid;
+static int64_t trace_offset;
+
+// every thread's buffer, pushed on first use
+static struct trace_buffer *volatile buffers;
+static __thread struct trace_buffer *buffer;
+
+void trace_init(const char *path, const char *process, int pid)
+{
+  trace_path = path;
+  trace_process = process;
+  trace_pid = pid;
+}
+
+int trace_enabled(void)
+{
+  return trace_path != NULL;
+}
+
+int64_t trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static struct trace_buffer *thread_buffer(void)
+{
+  struct trace_buffer *head;
+
+  if (buffer) { return buffer; }
+
+  buffer = calloc(1, sizeof(struct trace_buffer));
+  buffer->tid = syscall(SYS_gettid);
+
+  do
+  {
+    head = buffers;
+    buffer->next = head;
+  } while (!__sync_bool_compare_and_swap(&buffers, head, buffer));
+
+  return buffer;
+}
+
+static void record(const char *name, char phase)
+{
+  struct trace_buffer *b;
+
+  if (!trace_path) { return; }
+
+  b = thread_buffer();
+  if (b->num_events == TRACE_EVENTS) { return; }
+
+  b->events[b->num_events].name = name;
+  b->events[b->num_events].time = trace_now();
+  b->events[b->num_events].phase = phase;
+  ++b->num_events;
+}
+
+void trace_begin(const char *name)
+{
+  record(name, 'B');
+}
+
+void trace_end(const char *name)
+{
+  record(name, 'E');
+}
+
+void trace_set_offset(int64_t offset)
+{
+  trace_offset = offset;
+}
+
+void trace_write(void)
+{
+  struct trace_buffer *b;
+  FILE *fp;
+  int i;
+
+  if (!trace_path) { return; }
+
+  fp = fopen(trace_path, "w");
+  if (!fp)
+  {
+    perror("fopen trace file");
+    return;
+  }
+
+  /* JSON array format, the closing ] is optional so the files of both
+     nodes can simply be concatenated (minus the second opening [) */
+  fprintf(fp, "[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+      trace_pid, trace_process);
+
+  for (b = buffers; b; b = b->next)
+  {
+    for (i = 0; i < b->num_events; ++i)
+    {
+      fprintf(fp, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+          b->events[i].name, b->events[i].phase,
+          (b->events[i].time + trace_offset) / 1000.0, trace_pid, b->tid);
+    }
+
+    if (b->num_events == TRACE_EVENTS)
+    {
+      fprintf(stderr, "Trace buffer of thread %d full, later events dropped\n", b->tid);
+    }
+  }
+
+  fclose(fp);
+}
+
+int64_t trace_sync_client(volatile struct com_packets *local_packets,
+    volatile struct com_packets *remote_packets, int rounds)
+{
+  int64_t best_rtt = INT64_MAX;
+  int64_t offset = 0;
+  int i;
+
+  for (i = 1; i <= rounds; ++i)
+  {
+    int64_t start, end;
+
+    start = trace_now();
+    remote_packets->packet.ping = i;
+    remote_packets->packet.cmd = CMD_PING;
+    while (local_packets->packet.ping != (uint32_t)i);
+    end = trace_now();
+
+    __sync_synchronize();
+
+    // the answer was stamped somewhere in the round trip, assume the middle
+    if (end - start < best_rtt)
+    {
+      best_rtt = end - start;
+      offset = local_packets->packet.pong_time - (start + end)/2;
+    }
+  }
+
+  remote_packets->packet.clock_offset = offset;
+
+  fprintf(stderr, "Clock offset to server: %.3f us (round trip %.3f us)\n",
+      offset / 1000.0, best_rtt / 1000.0);
+
+  return offset;
+}
+
+void trace_sync_answer(volatile struct com_packets *local_packets,
+    volatile struct com_packets *remote_packets)
+{
+  int64_t now = trace_now();
+
+  local_packets->packet.cmd = CMD_INVALID;
+
+  remote_packets->packet.pong_time = now;
+  __sync_synchronize();
+  remote_packets->packet.ping = local_packets->packet.ping;
+}
@@ -0,0 +1,46 @@
+#ifndef C63_TRACE_H_
+#define C63_TRACE_H_
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+
+/* Timeline tracing. Every thread records begin/end events into its own
+   buffer, so recording takes no locks. At exit the events are written in
+   the Chrome trace-event JSON array format, which chrome://tracing and
+   Perfetto open directly. Both nodes write their own file and run.sh
+   --trace concatenates them; server timestamps are shifted onto the
+   client's clock using the offset measured by trace_sync_client.
+
+   Nothing is recorded unless trace_init has been called. */
+#define TRACE_EVENTS (1 << 16)   //per thread, later events are dropped
+
+void trace_init(const char *path, const char *process, int pid);
+
+int trace_enabled(void);
+
+// CLOCK_MONOTONIC in ns
+int64_t trace_now(void);
+
+void trace_begin(const char *name);
+
+void trace_end(const char *name);
+
+/* Added to every timestamp when the file is written, in ns */
+void trace_set_offset(int64_t offset);
+
+void trace_write(void);
+
+/* Clock offset between the nodes. The client sends numbered pings with
+   CMD_PING over the control segments and the server answers each with its
+   clock. The sample with the shortest round trip gives the offset of the
+   server clock from the client's, which is returned and also passed on to
+   the server in clock_offset. */
+int64_t trace_sync_client(volatile struct com_packets *local_packets,
+    volatile struct com_packets *remote_packets, int rounds);
+
+// Answer a ping, called by the server when it sees CMD_PING
+void trace_sync_answer(volatile struct com_packets *local_packets,
+    volatile struct com_packets *remote_packets);
+
+#endif  /* C63_TRACE_H_ */
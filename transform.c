@@ -0,0 +1,616 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "tables.h"
+#include "transform.h"
+
+/* Fixed-point constants for the Loeffler DCT, FIX(x) = x * 2^13 */
+#define CONST_BITS 13
+#define PASS1_BITS 2
+
+#define FIX_0_298631336 ((int32_t) 2446)
+#define FIX_0_390180644 ((int32_t) 3196)
+#define FIX_0_541196100 ((int32_t) 4433)
+#define FIX_0_765366865 ((int32_t) 6270)
+#define FIX_0_899976223 ((int32_t) 7373)
+#define FIX_1_175875602 ((int32_t) 9633)
+#define FIX_1_501321110 ((int32_t) 12299)
+#define FIX_1_847759065 ((int32_t) 15137)
+#define FIX_1_961570560 ((int32_t) 16069)
+#define FIX_2_053119869 ((int32_t) 16819)
+#define FIX_2_562915447 ((int32_t) 20995)
+#define FIX_3_072711026 ((int32_t) 25172)
+
+/* Right shift with rounding */
+#define DESCALE(x,n) (((x) + (1 << ((n)-1))) >> (n))
+
+/* Start out with TRANSFORM_DEFAULT, so binaries that never call
+   transform_select (the decoder and predictor) match the encoder */
+#ifdef C63_TRANSFORM_INT
+block_transform_t dct_quant_block = dct_quant_block_8x8_int;
+block_transform_t dequant_idct_block = dequant_idct_block_8x8_int;
+#else
+block_transform_t dct_quant_block = dct_quant_block_8x8;
+block_transform_t dequant_idct_block = dequant_idct_block_8x8;
+#endif
+
+void transform_select(enum transform_type type)
+{
+  if (type == TRANSFORM_INT)
+  {
+    dct_quant_block = dct_quant_block_8x8_int;
+    dequant_idct_block = dequant_idct_block_8x8_int;
+  }
+  else
+  {
+    dct_quant_block = dct_quant_block_8x8;
+    dequant_idct_block = dequant_idct_block_8x8;
+  }
+}
+
+const char *transform_name(enum transform_type type)
+{
+  return type == TRANSFORM_INT ? "int" : "float";
+}
+
+/* Forward DCT. Output is 8 times the orthonormal DCT, i.e. twice the
+   scale of the float DCT in dsp.c before its division by 4. */
+static void fdct_8x8(const int16_t *in_data, int32_t *out_data)
+{
+  int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  int32_t tmp10, tmp11, tmp12, tmp13;
+  int32_t z1, z2, z3, z4, z5;
+  int32_t *p;
+  int i;
+
+  /* Pass 1: rows, results are scaled up by 2^PASS1_BITS */
+  for (i = 0; i < 8; ++i)
+  {
+    const int16_t *d = in_data + i*8;
+    p = out_data + i*8;
+
+    tmp0 = d[0] + d[7];
+    tmp7 = d[0] - d[7];
+    tmp1 = d[1] + d[6];
+    tmp6 = d[1] - d[6];
+    tmp2 = d[2] + d[5];
+    tmp5 = d[2] - d[5];
+    tmp3 = d[3] + d[4];
+    tmp4 = d[3] - d[4];
+
+    /* Even part */
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    p[0] = (tmp10 + tmp11) << PASS1_BITS;
+    p[4] = (tmp10 - tmp11) << PASS1_BITS;
+
+    z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    p[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS-PASS1_BITS);
+    p[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS-PASS1_BITS);
+
+    /* Odd part */
+    z1 = tmp4 + tmp7;
+    z2 = tmp5 + tmp6;
+    z3 = tmp4 + tmp6;
+    z4 = tmp5 + tmp7;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    p[7] = DESCALE(tmp4 + z1 + z3, CONST_BITS-PASS1_BITS);
+    p[5] = DESCALE(tmp5 + z2 + z4, CONST_BITS-PASS1_BITS);
+    p[3] = DESCALE(tmp6 + z2 + z3, CONST_BITS-PASS1_BITS);
+    p[1] = DESCALE(tmp7 + z1 + z4, CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: columns, removes the PASS1_BITS scaling */
+  for (i = 0; i < 8; ++i)
+  {
+    p = out_data + i;
+
+    tmp0 = p[0*8] + p[7*8];
+    tmp7 = p[0*8] - p[7*8];
+    tmp1 = p[1*8] + p[6*8];
+    tmp6 = p[1*8] - p[6*8];
+    tmp2 = p[2*8] + p[5*8];
+    tmp5 = p[2*8] - p[5*8];
+    tmp3 = p[3*8] + p[4*8];
+    tmp4 = p[3*8] - p[4*8];
+
+    /* Even part */
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    p[0*8] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+    p[4*8] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+
+    z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    p[2*8] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS+PASS1_BITS);
+    p[6*8] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS+PASS1_BITS);
+
+    /* Odd part */
+    z1 = tmp4 + tmp7;
+    z2 = tmp5 + tmp6;
+    z3 = tmp4 + tmp6;
+    z4 = tmp5 + tmp7;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    p[7*8] = DESCALE(tmp4 + z1 + z3, CONST_BITS+PASS1_BITS);
+    p[5*8] = DESCALE(tmp5 + z2 + z4, CONST_BITS+PASS1_BITS);
+    p[3*8] = DESCALE(tmp6 + z2 + z3, CONST_BITS+PASS1_BITS);
+    p[1*8] = DESCALE(tmp7 + z1 + z4, CONST_BITS+PASS1_BITS);
+  }
+}
+
+/* Inverse DCT. Input is at orthonormal scale, output is the final sample
+   value rounded to the nearest integer. */
+static void idct_8x8(const int32_t *in_data, int16_t *out_data)
+{
+  int32_t tmp0, tmp1, tmp2, tmp3;
+  int32_t tmp10, tmp11, tmp12, tmp13;
+  int32_t z1, z2, z3, z4, z5;
+  int32_t ws[64];
+  int i;
+
+  /* Pass 1: columns into the workspace, scaled up by 2^PASS1_BITS */
+  for (i = 0; i < 8; ++i)
+  {
+    const int32_t *d = in_data + i;
+    int32_t *w = ws + i;
+
+    if (!d[1*8] && !d[2*8] && !d[3*8] && !d[4*8] &&
+        !d[5*8] && !d[6*8] && !d[7*8])
+    {
+      /* AC terms all zero, the column is flat */
+      int32_t dc = d[0] << PASS1_BITS;
+      w[0*8] = w[1*8] = w[2*8] = w[3*8] = dc;
+      w[4*8] = w[5*8] = w[6*8] = w[7*8] = dc;
+      continue;
+    }
+
+    /* Even part */
+    z2 = d[2*8];
+    z3 = d[6*8];
+    z1 = (z2 + z3) * FIX_0_541196100;
+    tmp2 = z1 - z3 * FIX_1_847759065;
+    tmp3 = z1 + z2 * FIX_0_765366865;
+
+    tmp0 = (d[0*8] + d[4*8]) << CONST_BITS;
+    tmp1 = (d[0*8] - d[4*8]) << CONST_BITS;
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    /* Odd part */
+    tmp0 = d[7*8];
+    tmp1 = d[5*8];
+    tmp2 = d[3*8];
+    tmp3 = d[1*8];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    z4 = tmp1 + tmp3;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp0 *= FIX_0_298631336;
+    tmp1 *= FIX_2_053119869;
+    tmp2 *= FIX_3_072711026;
+    tmp3 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    w[0*8] = DESCALE(tmp10 + tmp3, CONST_BITS-PASS1_BITS);
+    w[7*8] = DESCALE(tmp10 - tmp3, CONST_BITS-PASS1_BITS);
+    w[1*8] = DESCALE(tmp11 + tmp2, CONST_BITS-PASS1_BITS);
+    w[6*8] = DESCALE(tmp11 - tmp2, CONST_BITS-PASS1_BITS);
+    w[2*8] = DESCALE(tmp12 + tmp1, CONST_BITS-PASS1_BITS);
+    w[5*8] = DESCALE(tmp12 - tmp1, CONST_BITS-PASS1_BITS);
+    w[3*8] = DESCALE(tmp13 + tmp0, CONST_BITS-PASS1_BITS);
+    w[4*8] = DESCALE(tmp13 - tmp0, CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: rows, removes PASS1_BITS and the factor 8 of the 2D IDCT */
+  for (i = 0; i < 8; ++i)
+  {
+    const int32_t *w = ws + i*8;
+    int16_t *o = out_data + i*8;
+
+    /* Even part */
+    z2 = w[2];
+    z3 = w[6];
+    z1 = (z2 + z3) * FIX_0_541196100;
+    tmp2 = z1 - z3 * FIX_1_847759065;
+    tmp3 = z1 + z2 * FIX_0_765366865;
+
+    tmp0 = (w[0] + w[4]) << CONST_BITS;
+    tmp1 = (w[0] - w[4]) << CONST_BITS;
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    /* Odd part */
+    tmp0 = w[7];
+    tmp1 = w[5];
+    tmp2 = w[3];
+    tmp3 = w[1];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    z4 = tmp1 + tmp3;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp0 *= FIX_0_298631336;
+    tmp1 *= FIX_2_053119869;
+    tmp2 *= FIX_3_072711026;
+    tmp3 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    o[0] = DESCALE(tmp10 + tmp3, CONST_BITS+PASS1_BITS+3);
+    o[7] = DESCALE(tmp10 - tmp3, CONST_BITS+PASS1_BITS+3);
+    o[1] = DESCALE(tmp11 + tmp2, CONST_BITS+PASS1_BITS+3);
+    o[6] = DESCALE(tmp11 - tmp2, CONST_BITS+PASS1_BITS+3);
+    o[2] = DESCALE(tmp12 + tmp1, CONST_BITS+PASS1_BITS+3);
+    o[5] = DESCALE(tmp12 - tmp1, CONST_BITS+PASS1_BITS+3);
+    o[3] = DESCALE(tmp13 + tmp0, CONST_BITS+PASS1_BITS+3);
+    o[4] = DESCALE(tmp13 - tmp0, CONST_BITS+PASS1_BITS+3);
+  }
+}
+
+/* Integer division rounding half away from zero, like round() */
+static inline int32_t div_round(int32_t num, int32_t den)
+{
+  return num >= 0 ? (num + den/2) / den : -((-num + den/2) / den);
+}
+
+/* ceil(2^32 / 8q) for every table entry q, a zero entry counts as 1.
+   Generated at compile time, so all qp values are covered. */
+#define RECIP(d) ((uint32_t)(0xffffffffu / (d) + 1))
+#define RECIP1(q) RECIP(8*((q) ? (q) : 1))
+#define RECIP4(q) RECIP1(q), RECIP1(q+1), RECIP1(q+2), RECIP1(q+3)
+#define RECIP16(q) RECIP4(q), RECIP4(q+4), RECIP4(q+8), RECIP4(q+12)
+#define RECIP64(q) RECIP16(q), RECIP16(q+16), RECIP16(q+32), RECIP16(q+48)
+
+const uint32_t quant_recip[256] =
+{
+  RECIP64(0), RECIP64(64), RECIP64(128), RECIP64(192)
+};
+
+void dct_quant_block_8x8_int(int16_t *in_data, int16_t *out_data,
+    uint8_t *quant_tbl)
+{
+  int32_t coeff[64];
+  int zigzag;
+
+  fdct_8x8(in_data, coeff);
+
+  /* The float path computes round(dct/4/q) with dct at 4x orthonormal
+     scale, ours is at 8x, hence the 8. What the reciprocal saves is the
+     division; the loop itself stays scalar, it gathers through zigzag
+     and picks the sign per coefficient (and we build with
+     -fno-tree-vectorize anyway). */
+  for (zigzag = 0; zigzag < 64; ++zigzag)
+  {
+    uint8_t u = zigzag_U[zigzag];
+    uint8_t v = zigzag_V[zigzag];
+
+    out_data[zigzag] = quantize_int(coeff[v*8+u], quant_tbl[zigzag]);
+  }
+}
+
+void dequant_idct_block_8x8_int(int16_t *in_data, int16_t *out_data,
+    uint8_t *quant_tbl)
+{
+  int32_t coeff[64];
+  int zigzag;
+
+  /* Same rounding as the float dequantizer, round(dct*q/4), then back to
+     orthonormal scale for the IDCT */
+  for (zigzag = 0; zigzag < 64; ++zigzag)
+  {
+    uint8_t u = zigzag_U[zigzag];
+    uint8_t v = zigzag_V[zigzag];
+
+    coeff[v*8+u] = div_round(in_data[zigzag] * quant_tbl[zigzag], 4) * 4;
+  }
+
+  idct_8x8(coeff, out_data);
+}
+
+/* Number of coefficients up to and including the last nonzero one in
+   zigzag order, 0 for a block that quantized to all zeros */
+static inline uint8_t block_last_nz(const int16_t *coeff)
+{
+  int last = 64;
+
+  while (last && !coeff[last-1]) { --last; }
+
+  return last;
+}
+
+/* Reconstruction of a block without coefficients, the IDCT of zeros is
+   zero so the prediction is the result */
+static inline void copy_prediction(const uint8_t *pred, int pred_stride,
+    uint8_t *out, uint32_t width)
+{
+  int i;
+
+  for (i = 0; i < 8; ++i)
+  {
+    memcpy(out + i*width, pred + i*pred_stride, 8);
+  }
+}
+
+void transform_dequantize_idct(int16_t *in_data, uint8_t *prediction,
+    uint32_t width, uint32_t height, uint8_t *out_data, uint8_t *quantization)
+{
+  uint32_t x, y;
+  int i, j;
+  int16_t block[64];
+
+  for (y = 0; y < height; y += 8)
+  {
+    for (x = 0; x < width; x += 8)
+    {
+      uint8_t *pred = prediction + y*width + x;
+      uint8_t *out = out_data + y*width + x;
+
+      if (!block_last_nz(in_data + y*width + x*8))
+      {
+        copy_prediction(pred, width, out, width);
+        continue;
+      }
+
+      dequant_idct_block(in_data + y*width + x*8, block, quantization);
+
+      for (i = 0; i < 8; ++i)
+      {
+        for (j = 0; j < 8; ++j)
+        {
+          /* Add prediction block. Note: DCT is not precise -
+             Clamp to legal values */
+          int16_t tmp = block[i*8+j] + (int16_t)pred[i*width+j];
+
+          if (tmp < 0) { tmp = 0; }
+          else if (tmp > 255) { tmp = 255; }
+
+          out[i*width+j] = tmp;
+        }
+      }
+    }
+  }
+}
+
+/* One row of 8x8 blocks of a plane, y is the top pixel row. ref and mbs
+   are NULL when there is nothing to predict from. nz gets the
+   block_last_nz() of each block of the row, it may be NULL. */
+static void encode_block_row(const uint8_t *in_data, int tiled,
+    const uint8_t *ref, const struct macroblock *mbs, uint32_t width,
+    uint32_t y, int16_t *out_data, uint8_t *recons, uint8_t *quantization,
+    uint8_t *nz)
+{
+  uint32_t x;
+  int i, j;
+  uint8_t pred[64];
+  int16_t block[64];
+
+  for (x = 0; x < width; x += 8)
+  {
+    /* A tiled block sits at the same offset as its coefficients */
+    const uint8_t *in = tiled ? in_data + y*width + x*8 : in_data + y*width + x;
+    int in_stride = tiled ? 8 : width;
+    int16_t *coeff = out_data + y*width + x*8;
+    uint8_t *out = recons + y*width + x;
+
+    /* Motion compensation, blocks without a vector predict from zero */
+    if (ref && mbs[x/8].use_mv)
+    {
+      const uint8_t *mc = ref + (y + mbs[x/8].mv_y)*width + x + mbs[x/8].mv_x;
+
+      for (i = 0; i < 8; ++i)
+      {
+        memcpy(pred + i*8, mc + i*width, 8);
+      }
+    }
+    else
+    {
+      memset(pred, 0, sizeof(pred));
+    }
+
+    for (i = 0; i < 8; ++i)
+    {
+      for (j = 0; j < 8; ++j)
+      {
+        block[i*8+j] = (int16_t)in[i*in_stride+j] - pred[i*8+j];
+      }
+    }
+
+    dct_quant_block(block, coeff, quantization);
+
+    /* Still in L1, so finding the last coefficient is cheap here and saves
+       the writer and the reconstruction from looking again */
+    uint8_t last = block_last_nz(coeff);
+
+    if (nz) { nz[x/8] = last; }
+
+    if (!last)
+    {
+      copy_prediction(pred, 8, out, width);
+      continue;
+    }
+
+    dequant_idct_block(coeff, block, quantization);
+
+    for (i = 0; i < 8; ++i)
+    {
+      for (j = 0; j < 8; ++j)
+      {
+        int16_t tmp = block[i*8+j] + (int16_t)pred[i*8+j];
+
+        if (tmp < 0) { tmp = 0; }
+        else if (tmp > 255) { tmp = 255; }
+
+        out[i*width+j] = tmp;
+      }
+    }
+  }
+}
+
+void transform_encode_mb_row(struct c63_common *cm, yuv_t *src, int tiled,
+    int mb_row, uint8_t **nz)
+{
+  struct frame *frame = cm->curframe;
+  yuv_t *ref = frame->keyframe ? NULL : cm->refframe->recons;
+  uint32_t y;
+
+  /* Two rows of luma blocks */
+  for (y = mb_row*16; y < (uint32_t)mb_row*16 + 16; y += 8)
+  {
+    encode_block_row(src->Y, tiled, ref ? ref->Y : NULL,
+        frame->mbs[Y_COMPONENT] + (y/8)*(cm->padw[Y_COMPONENT]/8),
+        cm->padw[Y_COMPONENT], y, frame->residuals->Ydct, frame->recons->Y,
+        cm->quanttbl[Y_COMPONENT],
+        nz ? nz[Y_COMPONENT] + (y/8)*(cm->padw[Y_COMPONENT]/8) : NULL);
+  }
+
+  /* One row of blocks of each chroma plane */
+  y = mb_row*8;
+
+  encode_block_row(src->U, tiled, ref ? ref->U : NULL,
+      frame->mbs[U_COMPONENT] + (y/8)*(cm->padw[U_COMPONENT]/8),
+      cm->padw[U_COMPONENT], y, frame->residuals->Udct, frame->recons->U,
+      cm->quanttbl[U_COMPONENT],
+      nz ? nz[U_COMPONENT] + (y/8)*(cm->padw[U_COMPONENT]/8) : NULL);
+
+  encode_block_row(src->V, tiled, ref ? ref->V : NULL,
+      frame->mbs[V_COMPONENT] + (y/8)*(cm->padw[V_COMPONENT]/8),
+      cm->padw[V_COMPONENT], y, frame->residuals->Vdct, frame->recons->V,
+      cm->quanttbl[V_COMPONENT],
+      nz ? nz[V_COMPONENT] + (y/8)*(cm->padw[V_COMPONENT]/8) : NULL);
+}
+
+/* One row of 8x8 blocks of a plane for the decoder. Same prediction and
+   reconstruction as encode_block_row, starting from the coefficients. */
+static void decode_block_row(const int16_t *in_data, const uint8_t *ref,
+    const struct macroblock *mbs, uint32_t width, uint32_t y,
+    uint8_t *predicted, uint8_t *recons, uint8_t *quantization)
+{
+  uint32_t x;
+  int i, j;
+  int16_t block[64];
+
+  for (x = 0; x < width; x += 8)
+  {
+    uint8_t *pred = predicted + y*width + x;
+    uint8_t *out = recons + y*width + x;
+
+    if (ref && mbs[x/8].use_mv)
+    {
+      const uint8_t *mc = ref + (y + mbs[x/8].mv_y)*width + x + mbs[x/8].mv_x;
+
+      for (i = 0; i < 8; ++i)
+      {
+        memcpy(pred + i*width, mc + i*width, 8);
+      }
+    }
+    else
+    {
+      for (i = 0; i < 8; ++i)
+      {
+        memset(pred + i*width, 0, 8);
+      }
+    }
+
+    /* Checking the coefficients is far cheaper than an IDCT of zeros */
+    if (!block_last_nz(in_data + y*width + x*8))
+    {
+      copy_prediction(pred, width, out, width);
+      continue;
+    }
+
+    dequant_idct_block((int16_t *)in_data + y*width + x*8, block, quantization);
+
+    for (i = 0; i < 8; ++i)
+    {
+      for (j = 0; j < 8; ++j)
+      {
+        int16_t tmp = block[i*8+j] + (int16_t)pred[i*width+j];
+
+        if (tmp < 0) { tmp = 0; }
+        else if (tmp > 255) { tmp = 255; }
+
+        out[i*width+j] = tmp;
+      }
+    }
+  }
+}
+
+void transform_decode_mb_row(struct c63_common *cm, int mb_row)
+{
+  struct frame *frame = cm->curframe;
+  yuv_t *ref = frame->keyframe ? NULL : cm->refframe->recons;
+  uint32_t y;
+
+  for (y = mb_row*16; y < (uint32_t)mb_row*16 + 16; y += 8)
+  {
+    decode_block_row(frame->residuals->Ydct, ref ? ref->Y : NULL,
+        frame->mbs[Y_COMPONENT] + (y/8)*(cm->padw[Y_COMPONENT]/8),
+        cm->padw[Y_COMPONENT], y, frame->predicted->Y, frame->recons->Y,
+        cm->quanttbl[Y_COMPONENT]);
+  }
+
+  y = mb_row*8;
+
+  decode_block_row(frame->residuals->Udct, ref ? ref->U : NULL,
+      frame->mbs[U_COMPONENT] + (y/8)*(cm->padw[U_COMPONENT]/8),
+      cm->padw[U_COMPONENT], y, frame->predicted->U, frame->recons->U,
+      cm->quanttbl[U_COMPONENT]);
+
+  decode_block_row(frame->residuals->Vdct, ref ? ref->V : NULL,
+      frame->mbs[V_COMPONENT] + (y/8)*(cm->padw[V_COMPONENT]/8),
+      cm->padw[V_COMPONENT], y, frame->predicted->V, frame->recons->V,
+      cm->quanttbl[V_COMPONENT]);
+}
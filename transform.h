@@ -0,0 +1,90 @@
+#ifndef C63_TRANSFORM_H_
+#define C63_TRANSFORM_H_
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "c63.h"
+
+/* Selectable 8x8 block transform. The float path is the reference DCT in
+   dsp.c, the int path is a scaled fixed-point Loeffler DCT/IDCT (the
+   islow flowgraph from the IJG jpeg library) that needs no float ops and
+   keeps every intermediate within 32 bits. Both produce coefficients in
+   zigzag order with the same quantization, so the bitstream format does
+   not change, but the encoder and the decoder must use the same path to
+   avoid drift. */
+enum transform_type
+{
+  TRANSFORM_FLOAT,
+  TRANSFORM_INT
+};
+
+/* Default transform, can be changed with 'make TRANSFORM=int' so the
+   decoder and predictor get the same default as the encoder */
+#ifdef C63_TRANSFORM_INT
+#define TRANSFORM_DEFAULT TRANSFORM_INT
+#else
+#define TRANSFORM_DEFAULT TRANSFORM_FLOAT
+#endif
+
+typedef void (*block_transform_t)(int16_t *in_data, int16_t *out_data,
+    uint8_t *quant_tbl);
+
+/* Currently selected block kernels, set by transform_select() */
+extern block_transform_t dct_quant_block;
+extern block_transform_t dequant_idct_block;
+
+void transform_select(enum transform_type type);
+
+const char *transform_name(enum transform_type type);
+
+/* Quantizer of the int path, round(coeff / 8q) half away from zero like
+   div_round in transform.c, as a multiply and shift by a reciprocal in
+   place of the division. Exact for |coeff| <= QUANT_COEFF_MAX, well above
+   what the 8x scaled DCT of 8 bit samples produces (c63check tests every
+   value). */
+#define QUANT_COEFF_MAX (32767 - 4*255)
+
+extern const uint32_t quant_recip[256];
+
+static inline int32_t quantize_int(int32_t coeff, uint8_t q)
+{
+  uint32_t x = (uint32_t)(coeff >= 0 ? coeff : -coeff) + 4*(q ? q : 1);
+  int32_t r = (int32_t)(((uint64_t)x * quant_recip[q]) >> 32);
+
+  return coeff >= 0 ? r : -r;
+}
+
+void dct_quant_block_8x8_int(int16_t *in_data, int16_t *out_data,
+    uint8_t *quant_tbl);
+
+void dequant_idct_block_8x8_int(int16_t *in_data, int16_t *out_data,
+    uint8_t *quant_tbl);
+
+/* Full plane version of dequantize_idct from common.h that goes through
+   the selected block kernel, for the decoder */
+void transform_dequantize_idct(int16_t *in_data, uint8_t *prediction,
+    uint32_t width, uint32_t height, uint8_t *out_data, uint8_t *quantization);
+
+/* Fused encode of one macroblock row (16 luma rows, 8 rows of U and V):
+   motion compensation, residual, DCT, quantization, dequantization, IDCT
+   and reconstruction are done block by block while the block is in L1.
+   Motion vectors must already be estimated for inter frames. src is the
+   source frame, in block-tiled layout if tiled is set.
+
+   nz, if not NULL, holds a byte per 8x8 block for each plane in block
+   raster order. Each block of the row gets 0 if all its coefficients
+   quantized to zero (the block is not coded and its reconstruction is a
+   copy of the prediction), otherwise 1 + the zigzag index of its last
+   nonzero coefficient, so the writer can skip blocks and stop scanning
+   without looking at the coefficients. */
+void transform_encode_mb_row(struct c63_common *cm, yuv_t *src, int tiled,
+    int mb_row, uint8_t **nz);
+
+/* Decode of one macroblock row: motion compensation into
+   curframe->predicted, dequantization, IDCT and reconstruction into
+   curframe->recons. Rows only read the reference frame, so a frame can be
+   decoded with its rows spread over a pool (see pool.h). The result is the
+   same as motion compensation followed by transform_dequantize_idct. */
+void transform_decode_mb_row(struct c63_common *cm, int mb_row);
+
+#endif  /* C63_TRANSFORM_H_ */
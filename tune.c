@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sisci_error.h>
+#include <sisci_api.h>
+
+#include "dma.h"
+#include "tune.h"
+
+#define TUNE_ROUNDS 20
+
+void tune_key(char *key, size_t size, int width, int height,
+    unsigned int local_node, unsigned int remote_node)
+{
+  snprintf(key, size, "%dx%d %u-%u", width, height, local_node, remote_node);
+}
+
+int tune_load(const char *path, const char *key, struct tune *tune)
+{
+  char line[256];
+  size_t len = strlen(key);
+  FILE *fp = fopen(path, "r");
+  int found = 0;
+
+  if (!fp) { return 0; }
+
+  while (!found && fgets(line, sizeof(line), fp))
+  {
+    if (strncmp(line, key, len) || line[len] != ' ') { continue; }
+
+    found = sscanf(line + len, "%zu %d %d", &tune->dma_chunk,
+        &tune->dma_queues, &tune->pio_threshold) == 3;
+  }
+
+  fclose(fp);
+
+  return found;
+}
+
+void tune_save(const char *path, const char *key, const struct tune *tune)
+{
+  char line[256];
+  char *lines = NULL;
+  size_t used = 0;
+  size_t len = strlen(key);
+  FILE *fp = fopen(path, "r");
+
+  // keep the entries of other keys
+  if (fp)
+  {
+    while (fgets(line, sizeof(line), fp))
+    {
+      if (!strncmp(line, key, len) && line[len] == ' ') { continue; }
+
+      lines = realloc(lines, used + strlen(line) + 1);
+      strcpy(lines + used, line);
+      used += strlen(line);
+    }
+    fclose(fp);
+  }
+
+  fp = fopen(path, "w");
+  if (!fp)
+  {
+    perror("fopen tune cache");
+    free(lines);
+    return;
+  }
+
+  if (lines) { fputs(lines, fp); }
+  fprintf(fp, "%s %zu %d %d\n", key, tune->dma_chunk, tune->dma_queues,
+      tune->pio_threshold);
+
+  fclose(fp);
+  free(lines);
+}
+
+static double seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// Time to send one frame, all planes in flight at once like the encoder does
+static double time_frame(struct dma *dma, sci_local_segment_t local,
+    sci_remote_segment_t remote, const size_t *offset, const size_t *size)
+{
+  struct dma_transfer xfer[COLOR_COMPONENTS];
+  double start = seconds();
+  int c, i;
+
+  for (i = 0; i < TUNE_ROUNDS; ++i)
+  {
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      dma_transfer_init(dma, &xfer[c]);
+      dma_start(&xfer[c], local, remote, offset[c], offset[c], size[c]);
+    }
+    for (c = 0; c < COLOR_COMPONENTS; ++c)
+    {
+      dma_transfer_wait(&xfer[c]);
+    }
+  }
+
+  return (seconds() - start) / TUNE_ROUNDS;
+}
+
+void tune_search(struct tune *tune, sci_desc_t sd, unsigned int adapter,
+    sci_local_segment_t local, sci_remote_segment_t remote, void *local_map,
+    size_t map_size, const size_t *offset, const size_t *size, FILE *fp)
+{
+  static const int queues[] = { 1, 2, 4, 8 };
+  static const size_t chunks[] = { 0, 64*1024, 256*1024, 1024*1024, 4*1024*1024 };
+  double best = 0.0;
+  struct dma dma;
+  unsigned int q, k;
+  int c;
+  size_t i;
+
+  // synthetic frame, a gradient in every plane
+  for (c = 0; c < COLOR_COMPONENTS; ++c)
+  {
+    for (i = 0; i < size[c]; ++i)
+    {
+      ((uint8_t *)local_map)[offset[c] + i] = i;
+    }
+  }
+
+  if (fp)
+  {
+    fprintf(fp, "DMA sweep, %zu bytes per frame:\n", size[0] + size[1] + size[2]);
+    fprintf(fp, "  queues  chunk KiB    GB/s\n");
+  }
+
+  for (q = 0; q < sizeof(queues)/sizeof(queues[0]); ++q)
+  {
+    for (k = 0; k < sizeof(chunks)/sizeof(chunks[0]); ++k)
+    {
+      double t;
+
+      if (chunks[k] >= size[Y_COMPONENT]) { continue; }
+
+      dma_init(&dma, sd, adapter, queues[q], chunks[k]);
+      t = time_frame(&dma, local, remote, offset, size);
+      dma_free(&dma);
+
+      if (fp)
+      {
+        fprintf(fp, "  %6d  %9zu  %6.3f\n", queues[q], chunks[k]/1024,
+            (size[0] + size[1] + size[2]) / t / 1e9);
+      }
+
+      if (!best || t < best)
+      {
+        best = t;
+        tune->dma_queues = queues[q];
+        tune->dma_chunk = chunks[k];
+      }
+    }
+  }
+
+  // crossover for the winning DMA setup
+  dma_init(&dma, sd, adapter, tune->dma_queues, tune->dma_chunk);
+  dma_map_pio(&dma, local, local_map, remote, map_size);
+  tune->pio_threshold = dma_calibrate(&dma, local, size[Y_COMPONENT]);
+  dma_free(&dma);
+}
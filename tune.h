@@ -0,0 +1,40 @@
+#ifndef C63_TUNE_H_
+#define C63_TUNE_H_
+#include <stddef.h>
+#include <stdio.h>
+
+#include <sisci_api.h>
+
+#include "c63.h"
+
+/* Transfer parameters picked per resolution and node pair. tune_search
+   times synthetic frames sent the way the encoder sends them for every
+   combination of queue count and chunk size, then calibrates the PIO
+   threshold for the winner. Results are cached in TUNE_CACHE, one line
+   per key, so later runs start from them. */
+#define TUNE_CACHE "c63tune.cache"
+
+struct tune
+{
+  size_t dma_chunk;
+  int dma_queues;
+  int pio_threshold;
+};
+
+/* Cache key, "<width>x<height> <local node>-<remote node>" */
+void tune_key(char *key, size_t size, int width, int height,
+    unsigned int local_node, unsigned int remote_node);
+
+/* Returns non-zero if the cache has an entry for key */
+int tune_load(const char *path, const char *key, struct tune *tune);
+
+/* Adds or replaces the entry for key */
+void tune_save(const char *path, const char *key, const struct tune *tune);
+
+/* local_map is the mapped local segment, the planes are at offset[c] and
+   size[c] bytes long. Every combination is printed to fp if it is set. */
+void tune_search(struct tune *tune, sci_desc_t sd, unsigned int adapter,
+    sci_local_segment_t local, sci_remote_segment_t remote, void *local_map,
+    size_t map_size, const size_t *offset, const size_t *size, FILE *fp);
+
+#endif  /* C63_TUNE_H_ */